@@ -0,0 +1,50 @@
+#include <iconv.h>
+
+#include "libssid3.h"
+
+MyFrameIterator::MyFrameIterator(const char *filename)
+    : m_file(std::make_shared<MyFile>(filename, MyFile::BACKEND_MMAP)), m_parser(m_file),
+      m_started(false), m_has_frames(false) {
+}
+
+MyFrameIterator::MyFrameIterator(const char *name, const char *data, size_t size)
+    : m_file(std::make_shared<MyFile>(name, size, std::vector<char>(data, data + size), std::vector<char>())),
+      m_parser(m_file), m_started(false), m_has_frames(false) {
+}
+
+void MyFrameIterator::SetProjection(const id3v2_projection_t *proj) {
+    m_parser.SetProjection(proj);
+}
+
+void MyFrameIterator::SetNeedText(bool need_text) {
+    m_parser.SetNeedText(need_text);
+}
+
+// print_context_t strings point to m_frame_buf, valid until the next call.
+void MyFrameIterator::Store(const print_context_t& context, my_frame_t *frame) {
+    frame->offset = context.offset;
+    frame->size = context.size;
+    frame->name = context.frame_name;
+    frame->text = context.frame_body;
+    frame->body_offset = context.body_offset;
+    frame->body_size = context.body_size;
+    frame->body_raw = context.body_raw;
+    const char *body = (context.body_size > 0) ? m_file->Read(context.body_offset, context.body_size) : nullptr;
+    frame->body = (body != nullptr) ? std::string_view(body, context.body_size) : std::string_view();
+}
+
+bool MyFrameIterator::Next(my_frame_t *frame) {
+    if (!m_file->Ready()) {
+        return false;
+    }
+    print_context_t context;
+    if (!m_started) {
+        m_started = true;
+        m_has_frames = m_parser.Start(context, m_frame_buf);
+    } else if (!m_has_frames || !m_parser.Next(context, m_frame_buf)) {
+        m_has_frames = false;
+        return false;
+    }
+    Store(context, frame);
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef _LIBSSID3_H_
+#define _LIBSSID3_H_
+
+// libssid3: the ssid3 parser as a library.
+//
+//   MyFrameIterator it("a.mp3");
+//   my_frame_t frame;
+//   while (it.Next(&frame)) {
+//       // frame.name, frame.text, ...
+//   }
+//
+// Unlike the ssid3 command, which prints through callbacks, frames are
+// pulled one by one. Link with libssid3.a or libssid3.so.
+
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <bitset>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myarena.h"
+#include "myid3v2.h"
+#include "myid3v2stream.h"
+
+// One record, same as a line of ssid3. Each tag starts with "HEAD",
+// the first one even if no tag is found.
+// Views are valid until the next Next() call, except body which points
+// into the file and is valid while the iterator lives.
+typedef struct {
+    size_t offset;
+    size_t size;
+    std::string_view name;      // frame ID, like "TIT2"
+    std::string_view text;      // body as ssid3 prints it
+    std::string_view body;      // body in the file, undecoded if !body_raw
+    size_t body_offset;
+    size_t body_size;
+    bool body_raw;
+} my_frame_t;
+
+class MyFrameIterator {
+public:
+    // The file is mapped, and only ID3v2 is analyzed.
+    explicit MyFrameIterator(const char *filename);
+    // Analyzes a copy of the bytes of whole file, named as name.
+    MyFrameIterator(const char *name, const char *data, size_t size);
+    // Only frames in proj are returned. proj must live longer than this.
+    void SetProjection(const id3v2_projection_t *proj);
+    // Skips making text of the frames whose body is raw in the file.
+    void SetNeedText(bool need_text);
+    // Returns false if no more frames.
+    bool Next(my_frame_t *frame);
+private:
+    void Store(const print_context_t& context, my_frame_t *frame);
+    std::shared_ptr<MyFile> m_file;
+    MyID3V2 m_parser;
+    bool m_started;
+    bool m_has_frames;
+    id3v2_frame_buf_t m_frame_buf;
+};
+
+#endif /* _LIBSSID3_H_ */
@@ -0,0 +1,140 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <utility>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myape.h"
+#include "myarena.h"
+#include "mytrailer.h"
+
+// header and footer are the same, but a flag
+#define APE_FOOTER_SIZE (32)
+#define APE_FLAG_HAS_HEADER_BIT (31)
+// type of item in bits 1-2 of its flags
+#define APE_ITEM_TYPE(flags) (((flags) >> 1) & 3)
+#define APE_ITEM_UTF8   (0)
+#define APE_ITEM_BINARY (1)
+#define APE_ITEM_LINK   (2)
+// same as the big frames of ID3v2 are truncated
+#define APE_TRUNC_VALUE_SIZE (64*1024)
+
+static uint32_t ParseLE32(const char *ptr) {
+    auto u = reinterpret_cast<const unsigned char*>(ptr);
+    return u[0] + (u[1] << 8) + (u[2] << 16) + (static_cast<uint32_t>(u[3]) << 24);
+}
+
+MyAPEv2::MyAPEv2(std::shared_ptr<MyFile> file) : MyID3Base(std::move(file)) {
+}
+
+// http://wiki.hydrogenaud.io/index.php?title=APE_Tags_Header
+size_t MyAPEv2::AnalyzeItem(const std::function<void(const print_context_t&)> func,
+                            size_t offset, size_t end) {
+    // value size, flags, and the key up to 255 bytes with its terminator
+    size_t avail = end - offset;
+    if (avail < 8 + 2) {
+        return 0;
+    }
+    const char *item = m_file->Read(offset, (avail < 8 + 256) ? avail : 8 + 256);
+    if (item == nullptr) {
+        return 0;
+    }
+    size_t value_size = ParseLE32(item);
+    uint32_t flags = ParseLE32(item + 4);
+    size_t key_max = ((avail < 8 + 256) ? avail : 8 + 256) - 8;
+    size_t key_len = strnlen(item + 8, key_max);
+    // the key needs its terminator, and is printable ASCII as it is the frame name
+    if (key_len == 0 || key_len == key_max) {
+        return 0;
+    }
+    for (size_t i = 0; i < key_len; i++) {
+        if (item[8 + i] < 0x20 || item[8 + i] > 0x7e) {
+            return 0;
+        }
+    }
+    size_t value_offset = offset + 8 + key_len + 1;
+    if (value_offset > end || value_size > end - value_offset) {
+        return 0;
+    }
+    char key[256];
+    memcpy(key, item + 8, key_len);
+    key[key_len] = '\0';
+
+    MyArena::Scope scope;
+    size_t trunc_size = (value_size < APE_TRUNC_VALUE_SIZE) ? value_size : APE_TRUNC_VALUE_SIZE;
+    char *print_buf = scope.Alloc(trunc_size + 32);
+    print_context_t context {offset, value_offset + value_size - offset, key, print_buf,
+        m_file->filename.c_str(), value_offset, value_size, true};
+    print_buf[0] = '\0';
+    switch (APE_ITEM_TYPE(flags)) {
+        case APE_ITEM_BINARY:
+            sprintf(print_buf, "{BINARY}(%zx)", value_size);
+            break;
+        case APE_ITEM_LINK:
+        case APE_ITEM_UTF8:
+            if (m_need_text) {
+                size_t len = 0;
+                if (APE_ITEM_TYPE(flags) == APE_ITEM_LINK) {
+                    len = sprintf(print_buf, "{LINK}");
+                }
+                const char *value = m_file->Read(value_offset, trunc_size);
+                if (value == nullptr) {
+                    return 0;
+                }
+                // a list of values is separated by '\0'
+                for (size_t i = 0; i < trunc_size; i++) {
+                    print_buf[len++] = (value[i] == '\0') ? '/' : value[i];
+                }
+                print_buf[len] = '\0';
+            }
+            break;
+        default:
+            sprintf(print_buf, "{RESERVED}(%zx)", value_size);
+            break;
+    }
+    func(context);
+    return context.size;
+}
+
+void MyAPEv2::Analyze(const std::function<void(const print_context_t&)> func) {
+    char print_buf[64];
+    print_context_t context {0, 0, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
+
+    MyTrailer::trailers_t trailers;
+    MyTrailer::locate(*m_file, &trailers);
+    auto trailer = MyTrailer::find(trailers, MyTrailer::TRAILER_APEV2);
+    if (trailer == nullptr) {
+        strcpy(print_buf, "APE tag not found");
+        func(context);
+        return;
+    }
+    size_t footer_offset = trailer->offset + trailer->size - APE_FOOTER_SIZE;
+    const char *footer = m_file->Read(footer_offset, APE_FOOTER_SIZE);
+    if (footer == nullptr) {
+        strcpy(print_buf, "cannot read tail");
+        func(context);
+        return;
+    }
+    uint32_t version = ParseLE32(footer + 8);
+    uint32_t count = ParseLE32(footer + 16);
+    bool has_header = ParseLE32(footer + 20) & (1U << APE_FLAG_HAS_HEADER_BIT);
+    context.offset = trailer->offset;
+    context.size = trailer->size;
+    sprintf(print_buf, "APEv%u TotalTagSize(%zx) Items(%u)", version / 1000, trailer->size, count);
+    func(context);
+
+    size_t offset = trailer->offset + (has_header ? APE_FOOTER_SIZE : 0);
+    for (uint32_t i = 0; i < count && offset < footer_offset; i++) {
+        size_t item_size = AnalyzeItem(func, offset, footer_offset);
+        if (item_size == 0) {
+            break;
+        }
+        offset += item_size;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef _MYAPE_H_
+#define _MYAPE_H_
+
+// APEv2 (and APEv1) tag at the end of the file, found by MyTrailer.
+// Each item is reported with its key as the frame name.
+class MyAPEv2 : public MyID3Base {
+public:
+    MyAPEv2(std::shared_ptr<MyFile> file);
+    void Analyze(const std::function<void(const print_context_t&)>) override;
+private:
+    // Returns the size of the item at offset, or 0 if it is broken.
+    size_t AnalyzeItem(const std::function<void(const print_context_t&)> func,
+                       size_t offset, size_t end);
+};
+
+#endif /* _MYAPE_H_ */
@@ -0,0 +1,65 @@
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "myarena.h"
+
+#define ARENA_ALIGN (16)
+#define ARENA_MIN_BLOCK_SIZE (256*1024)
+
+MyArena& MyArena::Get() {
+    thread_local MyArena arena;
+    return arena;
+}
+
+// Moves to the first free block which has size bytes, or adds one.
+void MyArena::NextBlock(size_t size) {
+    size_t i = m_blocks.empty() ? 0 : m_block + 1;
+    for (; i < m_blocks.size(); i++) {
+        if (m_blocks[i].size >= size) {
+            break;
+        }
+    }
+    if (i == m_blocks.size()) {
+        size_t block_size = ARENA_MIN_BLOCK_SIZE;
+        if (!m_blocks.empty() && block_size < 2 * m_blocks.back().size) {
+            block_size = 2 * m_blocks.back().size;
+        }
+        if (block_size < size) {
+            block_size = size;
+        }
+        m_blocks.push_back({std::unique_ptr<char[]>(new char[block_size]), block_size});
+    }
+    m_block = i;
+    m_used = 0;
+}
+
+char *MyArena::Alloc(size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~static_cast<size_t>(ARENA_ALIGN - 1);
+    if (m_blocks.empty() || m_blocks[m_block].size - m_used < size) {
+        NextBlock(size);
+    }
+    char *ptr = m_blocks[m_block].ptr.get() + m_used;
+    m_used += size;
+    return ptr;
+}
+
+void MyArena::Reserve(size_t size) {
+    if (m_blocks.empty() || m_blocks[m_block].size - m_used < size) {
+        NextBlock(size);
+    }
+}
+
+void MyArena::Release(size_t block, size_t used) {
+    m_block = block;
+    m_used = used;
+    if (block == 0 && used == 0 && m_blocks.size() > 1) {
+        // all released, merge into one block for the next time
+        size_t total = 0;
+        for (auto& elem : m_blocks) {
+            total += elem.size;
+        }
+        m_blocks.clear();
+        m_blocks.push_back({std::unique_ptr<char[]>(new char[total]), total});
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _MYARENA_H_
+#define _MYARENA_H_
+
+// Per-thread bump allocator for the scratch buffers of the decoders,
+// instead of VLAs on the stack. Memory is not zeroed, and is kept after
+// use, so a thread allocates only when a bigger tag than ever comes.
+class MyArena {
+public:
+    // Returns the arena of the calling thread.
+    static MyArena& Get();
+    // Valid until the Scope which was alive at the call ends.
+    char *Alloc(size_t size);
+    // Makes size bytes allocatable without a new block, e.g. at the start
+    // of a tag to have its frames in one block.
+    void Reserve(size_t size);
+
+    // Allocations made during the scope are released at the end.
+    class Scope {
+    public:
+        Scope() : m_arena(Get()), m_block(m_arena.m_block), m_used(m_arena.m_used) {}
+        ~Scope() { m_arena.Release(m_block, m_used); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        char *Alloc(size_t size) { return m_arena.Alloc(size); }
+    private:
+        MyArena& m_arena;
+        size_t m_block;
+        size_t m_used;
+    };
+private:
+    MyArena() : m_block(0), m_used(0) {}
+    void Release(size_t block, size_t used);
+    void NextBlock(size_t size);
+    typedef struct {
+        std::unique_ptr<char[]> ptr;
+        size_t size;
+    } block_t;
+    std::vector<block_t> m_blocks;  // ones after m_block are free
+    size_t m_block;
+    size_t m_used;      // in m_blocks[m_block]
+};
+
+#endif /* _MYARENA_H_ */
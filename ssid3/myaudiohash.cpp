@@ -0,0 +1,43 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <utility>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myaudiohash.h"
+#include "myhash.h"
+#include "mytrailer.h"
+#include "mystats.h"
+
+MyAudioHash::MyAudioHash(std::shared_ptr<MyFile> file) : MyID3Base(std::move(file)) {
+}
+
+// Read by MyFile::Scan() in big pieces, which are hashed as they come.
+void MyAudioHash::Analyze(const std::function<void(const print_context_t&)> func) {
+    MyStats::Timer timer(MyStats::STAGE_AUDIO);
+    char print_buf[64];
+    size_t start;
+    size_t end;
+    MyTrailer::locate_audio(*m_file, &start, &end);
+    print_context_t context {start, end - start, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
+    sprintf(print_buf, "Audio TotalSize(%zx)", end - start);
+    func(context);
+
+    MyHash64 hash;
+    bool ok = m_file->Scan(start, end - start, [&hash](const char *ptr, size_t size) {
+        hash.Update(ptr, size);
+    });
+    context.frame_name = "XXH64";
+    if (ok) {
+        sprintf(print_buf, "%016llx", static_cast<unsigned long long>(hash.Digest()));
+    } else {
+        strcpy(print_buf, "cannot read audio");
+    }
+    func(context);
+}
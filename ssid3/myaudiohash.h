@@ -0,0 +1,12 @@
+#ifndef _MYAUDIOHASH_H_
+#define _MYAUDIOHASH_H_
+
+// XXH64 of the audio without any tags (see MyTrailer::locate_audio()),
+// so that the same track hashes the same after retagging.
+class MyAudioHash : public MyID3Base {
+public:
+    MyAudioHash(std::shared_ptr<MyFile> file);
+    void Analyze(const std::function<void(const print_context_t&)>) override;
+};
+
+#endif /* _MYAUDIOHASH_H_ */
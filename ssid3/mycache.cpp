@@ -0,0 +1,311 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "mycache.h"
+
+static const char cache_magic[8] = {'S', 'S', 'I', 'D', '3', 'I', 'D', 'X'};
+static const uint32_t cache_version = 3;
+
+
+MyScanCache::MyScanCache(const std::string& path, uint64_t option_key)
+    : m_path(path), m_option_key(option_key),
+      m_ptr(nullptr), m_size(0), m_index(nullptr), m_count(0) {
+    Load();
+}
+
+MyScanCache::~MyScanCache() {
+    if (m_ptr != nullptr) {
+        munmap(m_ptr, m_size);
+    }
+}
+
+std::string MyScanCache::DefaultPath() {
+    std::string dir;
+    const char *env = getenv("XDG_CACHE_HOME");
+    if (env != nullptr && env[0] != '\0') {
+        dir = env;
+    } else {
+        env = getenv("HOME");
+        dir = std::string((env != nullptr) ? env : ".") + "/.cache";
+    }
+    mkdir(dir.c_str(), 0755);
+    return dir + "/ssid3.idx";
+}
+
+bool MyScanCache::MakeKey(const char *filename, cache_key_t *key) {
+    struct stat st;
+    if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool MyScanCache::KeyLess(const cache_key_t& a, const cache_key_t& b) {
+    if (a.dev != b.dev) return a.dev < b.dev;
+    if (a.ino != b.ino) return a.ino < b.ino;
+    if (a.size != b.size) return a.size < b.size;
+    return a.mtime_ns < b.mtime_ns;
+}
+
+void MyScanCache::Load() {
+    int fd = open(m_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        // no cache yet
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(header_t)) {
+        m_ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (m_ptr == MAP_FAILED) {
+            perror(m_path.c_str());
+            m_ptr = nullptr;
+        } else {
+            m_size = st.st_size;
+        }
+    }
+    close(fd);
+    if (m_ptr == nullptr) {
+        return;
+    }
+
+    auto header = static_cast<const header_t*>(m_ptr);
+    if (memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header->version != cache_version ||
+        header->count > (m_size - sizeof(header_t)) / sizeof(index_t)) {
+        fprintf(stderr, "%s: broken cache, ignored\n", m_path.c_str());
+        return;
+    }
+    if (header->option_key != m_option_key) {
+        // scanned with other options, cannot reuse any of them.
+        return;
+    }
+    m_index = reinterpret_cast<const index_t*>(header + 1);
+    m_count = header->count;
+    m_used.assign(m_count, false);
+}
+
+// blob format (native endian):
+//   u32 path_len, path, where the file was when stored, and then
+//   u8 section, u64 offset, u64 size, u32 name_len, name, u32 body_len, body,
+//   u64 body_offset, u64 body_size, u8 body_raw
+// repeated for each record.
+template<class T>
+static bool ReadBlob(const char *&p, const char *end, T *val) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+        return false;
+    }
+    memcpy(val, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static bool ReadBlobString(const char *&p, const char *end, std::string *str) {
+    uint32_t len;
+    if (!ReadBlob(p, end, &len) || static_cast<size_t>(end - p) < len) {
+        return false;
+    }
+    str->assign(p, len);
+    p += len;
+    return true;
+}
+
+template<class T>
+static void WriteBlob(std::string& blob, T val) {
+    blob.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+static void WriteBlobString(std::string& blob, const std::string& str) {
+    WriteBlob<uint32_t>(blob, str.size());
+    blob.append(str);
+}
+
+bool MyScanCache::Lookup(const cache_key_t& key, std::vector<cache_record_t>& records) const {
+    auto end = m_index + m_count;
+    auto elem = std::lower_bound(m_index, end, key, [](const index_t& a, const cache_key_t& b) {
+        return KeyLess(a.key, b);
+    });
+    if (elem == end || KeyLess(key, elem->key)) {
+        return false;
+    }
+    if (elem->blob_offset > m_size || elem->blob_size > m_size - elem->blob_offset) {
+        return false;
+    }
+
+    const char *p = static_cast<const char*>(m_ptr) + elem->blob_offset;
+    const char *blob_end = p + elem->blob_size;
+    std::string path;
+    if (!ReadBlobString(p, blob_end, &path)) {
+        return false;
+    }
+    records.clear();
+    while (p < blob_end) {
+        cache_record_t record;
+        uint8_t section, body_raw;
+        uint64_t offset, size, body_offset, body_size;
+        if (!ReadBlob(p, blob_end, &section) ||
+            !ReadBlob(p, blob_end, &offset) ||
+            !ReadBlob(p, blob_end, &size) ||
+            !ReadBlobString(p, blob_end, &record.frame_name) ||
+            !ReadBlobString(p, blob_end, &record.frame_body) ||
+            !ReadBlob(p, blob_end, &body_offset) ||
+            !ReadBlob(p, blob_end, &body_size) ||
+            !ReadBlob(p, blob_end, &body_raw)) {
+            records.clear();
+            return false;
+        }
+        record.section = section;
+        record.offset = offset;
+        record.size = size;
+        record.body_offset = body_offset;
+        record.body_size = body_size;
+        record.body_raw = body_raw;
+        records.push_back(std::move(record));
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_used[elem - m_index] = true;
+    return true;
+}
+
+void MyScanCache::Store(const cache_key_t& key, const char *filename,
+                        const std::vector<cache_record_t>& records) {
+    std::string blob;
+    // absolute, as the next run may be in another directory
+    char *path = realpath(filename, nullptr);
+    WriteBlobString(blob, (path != nullptr) ? path : filename);
+    free(path);
+    for (auto& elem : records) {
+        WriteBlob<uint8_t>(blob, elem.section);
+        WriteBlob<uint64_t>(blob, elem.offset);
+        WriteBlob<uint64_t>(blob, elem.size);
+        WriteBlobString(blob, elem.frame_name);
+        WriteBlobString(blob, elem.frame_body);
+        WriteBlob<uint64_t>(blob, elem.body_offset);
+        WriteBlob<uint64_t>(blob, elem.body_size);
+        WriteBlob<uint8_t>(blob, elem.body_raw);
+    }
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_new.emplace_back(key, std::move(blob));
+}
+
+// An old entry is kept if it was looked up, or if its file is still
+// there with the same key. Others are of changed or deleted files.
+bool MyScanCache::IsLive(size_t index) const {
+    if (m_used[index]) {
+        return true;
+    }
+    auto& elem = m_index[index];
+    if (elem.blob_offset > m_size || elem.blob_size > m_size - elem.blob_offset) {
+        return false;
+    }
+    const char *p = static_cast<const char*>(m_ptr) + elem.blob_offset;
+    std::string path;
+    cache_key_t key;
+    if (!ReadBlobString(p, p + elem.blob_size, &path) || !MakeKey(path.c_str(), &key)) {
+        return false;
+    }
+    return !KeyLess(key, elem.key) && !KeyLess(elem.key, key);
+}
+
+// Merge new results into the live old entries, and replace the file.
+bool MyScanCache::Save() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (m_new.empty()) {
+        return true;
+    }
+    std::sort(m_new.begin(), m_new.end(), [](const std::pair<cache_key_t, std::string>& a,
+                                             const std::pair<cache_key_t, std::string>& b) {
+        return KeyLess(a.first, b.first);
+    });
+
+    typedef struct {
+        cache_key_t key;
+        const char *blob;
+        size_t size;
+    } merge_t;
+    std::vector<merge_t> merged;
+    size_t old_i = 0;
+    size_t new_i = 0;
+    while (old_i < m_count || new_i < m_new.size()) {
+        if (new_i < m_new.size() && (old_i >= m_count || !KeyLess(m_index[old_i].key, m_new[new_i].first))) {
+            auto& elem = m_new[new_i++];
+            // same key may be stored twice if a file is given twice.
+            if (!merged.empty() && !KeyLess(merged.back().key, elem.first)) {
+                continue;
+            }
+            merged.push_back({elem.first, elem.second.data(), elem.second.size()});
+            if (old_i < m_count && !KeyLess(elem.first, m_index[old_i].key)) {
+                // overwritten
+                old_i++;
+            }
+        } else if (!IsLive(old_i)) {
+            old_i++;
+        } else {
+            auto& elem = m_index[old_i++];
+            merged.push_back({elem.key, static_cast<const char*>(m_ptr) + elem.blob_offset,
+                              static_cast<size_t>(elem.blob_size)});
+        }
+    }
+
+    // unique, as other runs may save the same cache at the same time
+    std::string tmp_path = m_path + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd < 0) {
+        perror(tmp_path.c_str());
+        return false;
+    }
+    // mkstemp() makes it 0600, while the cache was created with the umask
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    FILE *fp = fdopen(fd, "wb");
+    if (fp == nullptr) {
+        perror(tmp_path.c_str());
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.option_key = m_option_key;
+    header.count = merged.size();
+    fwrite(&header, sizeof(header), 1, fp);
+    uint64_t blob_offset = sizeof(header_t) + merged.size() * sizeof(index_t);
+    for (auto& elem : merged) {
+        index_t index {elem.key, blob_offset, elem.size};
+        fwrite(&index, sizeof(index), 1, fp);
+        blob_offset += elem.size;
+    }
+    for (auto& elem : merged) {
+        fwrite(elem.blob, 1, elem.size, fp);
+    }
+    bool failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        perror(tmp_path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    if (rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+        perror(m_path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef _MYCACHE_H_
+#define _MYCACHE_H_
+
+// One print_context_t, or the start of an analyzer's output (section).
+typedef struct {
+    bool section;
+    size_t offset;
+    size_t size;
+    std::string frame_name;
+    std::string frame_body;
+    size_t body_offset;
+    size_t body_size;
+    bool body_raw;
+} cache_record_t;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+} cache_key_t;
+
+// Persistent scan result cache.
+// The file is a sorted index of cache_key_t followed by record blobs,
+// so that it can be looked up directly on the mapped memory.
+class MyScanCache {
+public:
+    MyScanCache(const std::string& path, uint64_t option_key);
+    ~MyScanCache();
+    static std::string DefaultPath();
+    static bool MakeKey(const char *filename, cache_key_t *key);
+    // thread safe
+    bool Lookup(const cache_key_t& key, std::vector<cache_record_t>& records) const;
+    void Store(const cache_key_t& key, const char *filename, const std::vector<cache_record_t>& records);
+    bool Save();
+private:
+    typedef struct {
+        cache_key_t key;
+        uint64_t blob_offset;
+        uint64_t blob_size;
+    } index_t;
+    typedef struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t option_key;
+        uint64_t count;
+    } header_t;
+    static bool KeyLess(const cache_key_t& a, const cache_key_t& b);
+    void Load();
+    bool IsLive(size_t index) const;
+    std::string m_path;
+    uint64_t m_option_key;
+    void *m_ptr;
+    size_t m_size;
+    const index_t *m_index;
+    size_t m_count;
+    mutable std::mutex m_lock;
+    // old entries looked up in this run
+    mutable std::vector<bool> m_used;
+    std::vector<std::pair<cache_key_t, std::string>> m_new;
+};
+
+#endif /* _MYCACHE_H_ */
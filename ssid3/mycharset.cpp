@@ -0,0 +1,306 @@
+#include <string>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYCHARSET_X86 (1)
+#endif
+
+#include "mycharset.h"
+
+
+namespace MyCharset {
+
+// a byte is acceptable if it is in [lo1, hi1] or [lo2, hi2]
+typedef struct {
+    unsigned char lo1;
+    unsigned char hi1;
+    unsigned char lo2;
+    unsigned char hi2;
+} byte_ranges_t;
+
+static const byte_ranges_t ranges_printable {0x20, 0x7e, 0x20, 0x7e};
+static const byte_ranges_t ranges_ascii {0x01, 0x7f, 0x01, 0x7f};
+static const byte_ranges_t ranges_8859 {0x20, 0x7e, 0xa0, 0xff};
+static const byte_ranges_t ranges_no_surrogate {0x00, 0xd7, 0xe0, 0xff};
+
+typedef size_t (*span_func_t)(const unsigned char *p, size_t n, const byte_ranges_t& r);
+
+static size_t span_scalar(const unsigned char *p, size_t n, const byte_ranges_t& r) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        if (!((r.lo1 <= c && c <= r.hi1) || (r.lo2 <= c && c <= r.hi2))) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#if defined(MYCHARSET_X86)
+// unsigned (x - lo) <= (hi - lo) means lo <= x <= hi.
+static size_t span_sse2(const unsigned char *p, size_t n, const byte_ranges_t& r) {
+    const __m128i lo1 = _mm_set1_epi8(r.lo1);
+    const __m128i d1 = _mm_set1_epi8(r.hi1 - r.lo1);
+    const __m128i lo2 = _mm_set1_epi8(r.lo2);
+    const __m128i d2 = _mm_set1_epi8(r.hi2 - r.lo2);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i t1 = _mm_sub_epi8(x, lo1);
+        __m128i t2 = _mm_sub_epi8(x, lo2);
+        __m128i in1 = _mm_cmpeq_epi8(_mm_min_epu8(t1, d1), t1);
+        __m128i in2 = _mm_cmpeq_epi8(_mm_min_epu8(t2, d2), t2);
+        unsigned int bad = ~_mm_movemask_epi8(_mm_or_si128(in1, in2)) & 0xffff;
+        if (bad != 0) {
+            return i + __builtin_ctz(bad);
+        }
+    }
+    return i + span_scalar(p + i, n - i, r);
+}
+
+__attribute__((target("avx2")))
+static size_t span_avx2(const unsigned char *p, size_t n, const byte_ranges_t& r) {
+    const __m256i lo1 = _mm256_set1_epi8(r.lo1);
+    const __m256i d1 = _mm256_set1_epi8(r.hi1 - r.lo1);
+    const __m256i lo2 = _mm256_set1_epi8(r.lo2);
+    const __m256i d2 = _mm256_set1_epi8(r.hi2 - r.lo2);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i t1 = _mm256_sub_epi8(x, lo1);
+        __m256i t2 = _mm256_sub_epi8(x, lo2);
+        __m256i in1 = _mm256_cmpeq_epi8(_mm256_min_epu8(t1, d1), t1);
+        __m256i in2 = _mm256_cmpeq_epi8(_mm256_min_epu8(t2, d2), t2);
+        unsigned int bad = ~static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_or_si256(in1, in2)));
+        if (bad != 0) {
+            return i + __builtin_ctz(bad);
+        }
+    }
+    return i + span_sse2(p + i, n - i, r);
+}
+#endif
+
+static span_func_t select_span() {
+#if defined(MYCHARSET_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return span_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return span_sse2;
+    }
+#endif
+    return span_scalar;
+}
+
+static const span_func_t span = select_span();
+
+
+static const char *charset_names[CHARSET_NUM] = {
+    "ASCII",
+    "UTF-8",
+    "CP932",
+    "UTF-16",
+    "UTF-16BE",
+    "UTF-16LE",
+    "ISO-8859-1",
+};
+
+const char *name(charset_t cs) {
+    return charset_names[cs];
+}
+
+bool find(const char *name, charset_t *cs) {
+    for (int i = 0; i < CHARSET_NUM; i++) {
+        if (strcasecmp(name, charset_names[i]) == 0) {
+            *cs = static_cast<charset_t>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int score_ranges(const unsigned char *p, size_t len, const byte_ranges_t& r, int valid_score) {
+    return (span(p, len, r) == len) ? valid_score : 0;
+}
+
+// Same as glibc's UTF-8 decoder: no overlong forms, no surrogates,
+// nothing beyond U+10FFFF.
+static int score_utf8(const unsigned char *p, size_t len) {
+    int score = 100;
+    for (size_t i = 0; i < len; ) {
+        i += span(p + i, len - i, ranges_ascii);
+        if (i >= len) {
+            break;
+        }
+        unsigned char c = p[i];
+        unsigned char lo = 0x80;
+        unsigned char hi = 0xbf;
+        size_t follow;
+        if (0xc2 <= c && c <= 0xdf) {
+            follow = 1;
+            // C1 control characters are unlikely in text.
+            if (c == 0xc2 && i+1 < len && p[i+1] <= 0x9f) {
+                score -= 10;
+            }
+        } else if (0xe0 <= c && c <= 0xef) {
+            follow = 2;
+            if (c == 0xe0) {
+                lo = 0xa0;
+            } else if (c == 0xed) {
+                hi = 0x9f;
+            }
+        } else if (0xf0 <= c && c <= 0xf4) {
+            follow = 3;
+            if (c == 0xf0) {
+                lo = 0x90;
+            } else if (c == 0xf4) {
+                hi = 0x8f;
+            }
+        } else {
+            return 0;
+        }
+        if (i + follow >= len) {
+            return 0;
+        }
+        if (p[i+1] < lo || hi < p[i+1]) {
+            return 0;
+        }
+        for (size_t j = 2; j <= follow; j++) {
+            if (p[i+j] < 0x80 || 0xbf < p[i+j]) {
+                return 0;
+            }
+        }
+        i += 1 + follow;
+    }
+    return (score > 1) ? score : 1;
+}
+
+// Double byte characters which glibc's CP932 converter accepts.
+static bool cp932_pair_ok(unsigned char lead, unsigned char trail) {
+    if (!((0x40 <= trail && trail <= 0x7e) || (0x80 <= trail && trail <= 0xfc))) {
+        return false;
+    }
+    switch (lead) {
+        case 0x81:
+            return trail <= 0xac || (0xb8 <= trail && trail <= 0xbf) ||
+                (0xc8 <= trail && trail <= 0xce) || (0xda <= trail && trail <= 0xe8) ||
+                (0xf0 <= trail && trail <= 0xf7) || trail == 0xfc;
+        case 0x82:
+            return (0x4f <= trail && trail <= 0x58) || (0x60 <= trail && trail <= 0x79) ||
+                (0x81 <= trail && trail <= 0x9a) || (0x9f <= trail && trail <= 0xf1);
+        case 0x83:
+            return trail <= 0x96 || (0x9f <= trail && trail <= 0xb6) ||
+                (0xbf <= trail && trail <= 0xd6);
+        case 0x84:
+            return trail <= 0x60 || (0x70 <= trail && trail <= 0x91) ||
+                (0x9f <= trail && trail <= 0xbe);
+        case 0x87:
+            return (trail <= 0x75 && trail != 0x5e) || trail == 0x7e ||
+                (0x80 <= trail && trail <= 0x9c);
+        case 0x88:
+            return 0x9f <= trail;
+        case 0x98:
+            return trail <= 0x72 || 0x9f <= trail;
+        case 0xea:
+            return trail <= 0xa4;
+        case 0xee:
+            return trail <= 0xec || 0xef <= trail;
+        case 0xfc:
+            return trail <= 0x4b;
+        default:
+            break;
+    }
+    return (0x89 <= lead && lead <= 0x9f) || (0xe0 <= lead && lead <= 0xe9) ||
+        lead == 0xed || (0xf0 <= lead && lead <= 0xfb);
+}
+
+static int score_cp932(const unsigned char *p, size_t len) {
+    int score = 99;
+    for (size_t i = 0; i < len; ) {
+        i += span(p + i, len - i, ranges_ascii);
+        if (i >= len) {
+            break;
+        }
+        unsigned char c = p[i];
+        if (0xa1 <= c && c <= 0xdf) {
+            // half width katakana, often found in broken UTF-8 as well.
+            score--;
+            i++;
+            continue;
+        }
+        if (i+1 >= len || !cp932_pair_ok(c, p[i+1])) {
+            return 0;
+        }
+        i += 2;
+    }
+    return (score > 51) ? score : 51;
+}
+
+static int score_utf16(const unsigned char *p, size_t len, bool big_endian, bool need_bom) {
+    if (len % 2 != 0) {
+        return 0;
+    }
+    size_t i = 0;
+    if (need_bom && len > 0) {
+        // Without BOM, iconv("UTF-16") writes BOM which does not fit in
+        // the same size. So BOM is required as before.
+        if (p[0] == 0xfe && p[1] == 0xff) {
+            big_endian = true;
+        } else if (p[0] == 0xff && p[1] == 0xfe) {
+            big_endian = false;
+        } else {
+            return 0;
+        }
+        i = 2;
+    }
+    int hi_pos = big_endian ? 0 : 1;
+    while (i < len) {
+        // no surrogate in the chunk means no pair to check.
+        i += span(p + i, len - i, ranges_no_surrogate) & ~static_cast<size_t>(1);
+        if (i >= len) {
+            break;
+        }
+        unsigned char hi = p[i + hi_pos];
+        if (hi < 0xd8 || 0xdf < hi) {
+            i += 2;
+            continue;
+        }
+        if (hi >= 0xdc || i+4 > len) {
+            // lone low surrogate, or high surrogate at the end
+            return 0;
+        }
+        unsigned char next_hi = p[i + 2 + hi_pos];
+        if (next_hi < 0xdc || 0xdf < next_hi) {
+            return 0;
+        }
+        i += 4;
+    }
+    return 98;
+}
+
+int score(charset_t cs, const char *src, size_t src_len) {
+    auto p = reinterpret_cast<const unsigned char*>(src);
+    switch (cs) {
+        case CHARSET_ASCII:
+            return score_ranges(p, strnlen(src, src_len), ranges_printable, 100);
+        case CHARSET_UTF8:
+            return score_utf8(p, strnlen(src, src_len));
+        case CHARSET_CP932:
+            return score_cp932(p, strnlen(src, src_len));
+        case CHARSET_UTF16:
+            return score_utf16(p, src_len, true, true);
+        case CHARSET_UTF16BE:
+            return score_utf16(p, src_len, true, false);
+        case CHARSET_UTF16LE:
+            return score_utf16(p, src_len, false, false);
+        case CHARSET_8859:
+            // ISO-8859-1 accepts almost everything, so it is a weak guess.
+            return score_ranges(p, strnlen(src, src_len), ranges_8859, 50);
+        default:
+            break;
+    }
+    return 0;
+}
+
+} // namespace MyCharset
@@ -0,0 +1,29 @@
+#ifndef _MYCHARSET_H_
+#define _MYCHARSET_H_
+
+// Charset validators which classify a buffer in a single pass.
+// Runs of plain bytes are skipped with SSE2/AVX2 when the CPU has them.
+namespace MyCharset {
+
+typedef enum {
+    CHARSET_ASCII,
+    CHARSET_UTF8,
+    CHARSET_CP932,
+    CHARSET_UTF16,      // with BOM
+    CHARSET_UTF16BE,
+    CHARSET_UTF16LE,
+    CHARSET_8859,
+    CHARSET_NUM,
+} charset_t;
+
+// name for iconv
+const char *name(charset_t cs);
+bool find(const char *name, charset_t *cs);
+// Confidence that src is written in cs, 0 (invalid) to 100.
+// Same as iconv, UTF-16 variants are checked for whole src_len bytes,
+// and the others are checked until '\0'.
+int score(charset_t cs, const char *src, size_t src_len);
+
+} // namespace MyCharset
+
+#endif /* _MYCHARSET_H_ */
@@ -0,0 +1,233 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <mutex>
+#include <utility>
+
+#include "myhash.h"
+#include "myid3v2edit.h"
+#include "myeditjournal.h"
+
+// a group is committed at either of these
+#define JOURNAL_GROUP_FILES (256)
+#define JOURNAL_GROUP_BYTES (64*1024*1024)
+
+// journal format (native endian), written at once for each group:
+//   u64 count, then for each plan:
+//   u32 name_len, name, u64 filesize, u64 insert, u64 offset, u64 data_len, data
+//   and u64 XXH64 of all of the above.
+template<class T>
+static bool ReadBlob(const char *&p, const char *end, T *val) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) {
+        return false;
+    }
+    memcpy(val, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+template<class L>
+static bool ReadBlobString(const char *&p, const char *end, std::string *str) {
+    L len;
+    if (!ReadBlob(p, end, &len) || static_cast<size_t>(end - p) < len) {
+        return false;
+    }
+    str->assign(p, len);
+    p += len;
+    return true;
+}
+
+template<class T>
+static void WriteBlob(std::string& blob, T val) {
+    blob.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<class L>
+static void WriteBlobString(std::string& blob, const std::string& str) {
+    WriteBlob<L>(blob, str.size());
+    blob.append(str);
+}
+
+MyEditJournal::MyEditJournal(const std::string& path)
+    : m_path(path), m_fd(-1), m_group_bytes(0), m_failed(0) {
+}
+
+MyEditJournal::~MyEditJournal() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool MyEditJournal::Recover() {
+    if (m_path.empty()) {
+        return true;
+    }
+    m_fd = open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) != 0) {
+        perror(m_path.c_str());
+        return false;
+    }
+    // the journal itself should survive a crash
+    MyID3V2Edit::SyncDir(m_path);
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    std::vector<char> buf(st.st_size);
+    if (pread(m_fd, buf.data(), buf.size(), 0) != static_cast<ssize_t>(buf.size())) {
+        perror(m_path.c_str());
+        return false;
+    }
+    const char *p = buf.data();
+    const char *end = p + buf.size();
+    std::vector<id3v2_edit_plan_t> group;
+    uint64_t count;
+    bool ok = ReadBlob(p, end, &count);
+    for (uint64_t i = 0; ok && i < count; i++) {
+        id3v2_edit_plan_t plan;
+        uint64_t filesize = 0;
+        uint64_t insert = 0;
+        uint64_t offset = 0;
+        ok = ReadBlobString<uint32_t>(p, end, &plan.filename) && ReadBlob(p, end, &filesize) &&
+             ReadBlob(p, end, &insert) && ReadBlob(p, end, &offset) &&
+             ReadBlobString<uint64_t>(p, end, &plan.data);
+        plan.filesize = filesize;
+        plan.insert = insert;
+        plan.offset = offset;
+        group.push_back(std::move(plan));
+    }
+    uint64_t hash;
+    const char *hashed_end = p;
+    ok = ok && ReadBlob(p, end, &hash) && hash == MyHash64::Hash(buf.data(), hashed_end - buf.data());
+    if (ok) {
+        fprintf(stderr, "%s: writing %zu files left by the last run\n", m_path.c_str(), group.size());
+        AddFailed(WriteGroup(group, true));
+    } else {
+        // crashed while writing the journal, no file was touched
+        fprintf(stderr, "%s: incomplete journal is discarded\n", m_path.c_str());
+    }
+    if (ftruncate(m_fd, 0) != 0) {
+        perror(m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void MyEditJournal::Add(id3v2_edit_plan_t&& plan) {
+    if (m_fd < 0) {
+        AddFailed(WriteGroup(std::vector<id3v2_edit_plan_t>{std::move(plan)}, false));
+        return;
+    }
+    std::vector<id3v2_edit_plan_t> group;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_group_bytes += plan.data.size();
+        m_group.push_back(std::move(plan));
+        if (m_group.size() < JOURNAL_GROUP_FILES && m_group_bytes < JOURNAL_GROUP_BYTES) {
+            return;
+        }
+        group.swap(m_group);
+        m_group_bytes = 0;
+    }
+    // others go on preparing the next group meanwhile
+    Commit(group);
+}
+
+void MyEditJournal::Flush() {
+    std::vector<id3v2_edit_plan_t> group;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        group.swap(m_group);
+        m_group_bytes = 0;
+    }
+    if (!group.empty()) {
+        Commit(group);
+    }
+}
+
+size_t MyEditJournal::Failed() {
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_failed;
+}
+
+void MyEditJournal::AddFailed(size_t count) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_failed += count;
+}
+
+void MyEditJournal::Commit(const std::vector<id3v2_edit_plan_t>& group) {
+    std::string blob;
+    WriteBlob<uint64_t>(blob, group.size());
+    for (auto& plan : group) {
+        WriteBlobString<uint32_t>(blob, plan.filename);
+        WriteBlob<uint64_t>(blob, plan.filesize);
+        WriteBlob<uint64_t>(blob, plan.insert);
+        WriteBlob<uint64_t>(blob, plan.offset);
+        WriteBlobString<uint64_t>(blob, plan.data);
+    }
+    WriteBlob<uint64_t>(blob, MyHash64::Hash(blob.data(), blob.size()));
+
+    std::lock_guard<std::mutex> guard(m_commit_lock);
+    size_t done = 0;
+    while (done < blob.size()) {
+        ssize_t ret = pwrite(m_fd, blob.data() + done, blob.size() - done, done);
+        if (ret <= 0) {
+            break;
+        }
+        done += ret;
+    }
+    if (done < blob.size() || fdatasync(m_fd) != 0) {
+        // not a file is touched
+        perror(m_path.c_str());
+        if (ftruncate(m_fd, 0) != 0) {
+            perror(m_path.c_str());
+        }
+        AddFailed(group.size());
+        return;
+    }
+    AddFailed(WriteGroup(group, true));
+    if (ftruncate(m_fd, 0) != 0) {
+        perror(m_path.c_str());
+    }
+}
+
+// Writeback of all the files is started before waiting for any of them,
+// so that the group costs about one sync rather than one for each file.
+// Returns the number of files failed.
+size_t MyEditJournal::WriteGroup(const std::vector<id3v2_edit_plan_t>& group, bool sync) {
+    size_t failed = 0;
+    std::vector<std::pair<int, const char*>> fds;
+    for (auto& plan : group) {
+        int fd = open(plan.filename.c_str(), O_RDWR);
+        if (fd < 0) {
+            perror(plan.filename.c_str());
+            failed++;
+            continue;
+        }
+        if (!MyID3V2Edit::Write(fd, plan)) {
+            failed++;
+            close(fd);
+            continue;
+        }
+        if (sync) {
+            sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+        fds.emplace_back(fd, plan.filename.c_str());
+    }
+    for (auto& elem : fds) {
+        if (sync && fdatasync(elem.first) != 0) {
+            perror(elem.second);
+            failed++;
+        }
+        close(elem.first);
+    }
+    return failed;
+}
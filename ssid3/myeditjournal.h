@@ -0,0 +1,37 @@
+#ifndef _MYEDITJOURNAL_H_
+#define _MYEDITJOURNAL_H_
+
+// Writes edit plans in groups through a write-ahead journal, so that a
+// crash never leaves half-written tags. A group is written into the
+// journal and synced once, then written to the files, which are synced
+// together, and the journal is cleared. A group left in the journal by
+// a crash is written again by Recover(); a group not completely in the
+// journal has not touched any file yet.
+// Without the journal path, each plan is written as it comes, unsynced.
+class MyEditJournal {
+public:
+    explicit MyEditJournal(const std::string& path);
+    ~MyEditJournal();
+    // Returns false if the journal cannot be used.
+    bool Recover();
+    // thread safe. Commits the group when it is full.
+    void Add(id3v2_edit_plan_t&& plan);
+    // Commits the rest.
+    void Flush();
+    // Number of files not written or not synced, including those of
+    // groups the journal could not be written for.
+    size_t Failed();
+private:
+    void Commit(const std::vector<id3v2_edit_plan_t>& group);
+    void AddFailed(size_t count);
+    static size_t WriteGroup(const std::vector<id3v2_edit_plan_t>& group, bool sync);
+    std::string m_path;
+    int m_fd;
+    std::mutex m_lock;          // of m_group and m_failed
+    std::mutex m_commit_lock;   // of the journal file
+    std::vector<id3v2_edit_plan_t> m_group;
+    size_t m_group_bytes;
+    size_t m_failed;
+};
+
+#endif /* _MYEDITJOURNAL_H_ */
@@ -0,0 +1,236 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myarena.h"
+#include "myhash.h"
+#include "myunsync.h"
+#include "myextract.h"
+
+// headers of the payloads are in here, or not supported
+#define EXTRACT_PREFIX_SIZE (4096)
+
+namespace MyExtract {
+
+bool is_object_frame(const char *frame_name) {
+    return strcmp(frame_name, "APIC") == 0 || strcmp(frame_name, "GEOB") == 0 ||
+        strcmp(frame_name, "PIC") == 0;
+}
+
+// Length of the text including its terminator, or 0 if not terminated
+// within size.
+static size_t text_length(const char *p, size_t size, unsigned char enc) {
+    if (enc == 1 || enc == 2) {
+        for (size_t i = 0; i + 1 < size; i += 2) {
+            if (p[i] == '\0' && p[i+1] == '\0') {
+                return i + 2;
+            }
+        }
+        return 0;
+    }
+    auto end = static_cast<const char*>(memchr(p, '\0', size));
+    return (end != nullptr) ? end - p + 1 : 0;
+}
+
+// Returns the size of the header before the payload, or 0 if broken.
+static size_t parse_header(const char *frame_name, const char *p, size_t size, char *mime, size_t mime_size) {
+    if (size < 1) {
+        return 0;
+    }
+    unsigned char enc = p[0];
+    size_t i = 1;
+    if (strcmp(frame_name, "PIC") == 0) {
+        // 3 chars of image format, like "JPG"
+        if (size < i + 4) {
+            return 0;
+        }
+        snprintf(mime, mime_size, "image/%c%c%c", tolower(p[1]), tolower(p[2]), tolower(p[3]));
+        i += 3 + 1;
+    } else {
+        size_t len = text_length(p + i, size - i, 0);
+        if (len == 0) {
+            return 0;
+        }
+        snprintf(mime, mime_size, "%s", p + i);
+        i += len;
+        if (strcmp(frame_name, "APIC") == 0) {
+            // picture type
+            i += 1;
+        } else {
+            // GEOB filename
+            len = (i < size) ? text_length(p + i, size - i, enc) : 0;
+            if (len == 0) {
+                return 0;
+            }
+            i += len;
+        }
+    }
+    // description
+    size_t len = (i < size) ? text_length(p + i, size - i, enc) : 0;
+    if (len == 0) {
+        return 0;
+    }
+    return i + len;
+}
+
+// Passes the payload to func in pieces.
+static bool scan_payload(MyFile& file, const object_t& object, const std::function<void(const char*, size_t)>& func) {
+    if (object.raw) {
+        return file.Scan(object.offset, object.size, func);
+    }
+    MyUnsync::Decoder decoder;
+    size_t skip = object.skip;
+    size_t rest = object.size;
+    return file.Scan(object.offset, object.body_size, [&](const char *ptr, size_t size) {
+        MyArena::Scope scope;
+        char *buf = scope.Alloc(size);
+        size_t len = decoder.Feed(ptr, size, buf);
+        size_t drop = (skip < len) ? skip : len;
+        skip -= drop;
+        len -= drop;
+        if (len > rest) {
+            len = rest;
+        }
+        rest -= len;
+        if (len > 0) {
+            func(buf + drop, len);
+        }
+    });
+}
+
+bool locate(MyFile& file, const print_context_t& context, object_t *object) {
+    // Frames with data added by the flags, which may be compressed or
+    // encrypted, have their body after the frame header and that data.
+    size_t frame_header_size = (strlen(context.frame_name) == 3) ? 6 : 10;
+    if (context.body_offset != context.offset + frame_header_size) {
+        return false;
+    }
+    size_t prefix_size = (context.body_size < EXTRACT_PREFIX_SIZE) ? context.body_size : EXTRACT_PREFIX_SIZE;
+    const char *prefix = file.Read(context.body_offset, prefix_size);
+    if (prefix == nullptr) {
+        return false;
+    }
+    MyArena::Scope scope;
+    size_t body_size = context.body_size;
+    if (!context.body_raw) {
+        char *buf = scope.Alloc(prefix_size);
+        MyUnsync::Decoder decoder;
+        prefix_size = decoder.Feed(prefix, prefix_size, buf);
+        prefix = buf;
+        // the decoded size is known after scanning
+        body_size = SIZE_MAX;
+    }
+    size_t header_size = parse_header(context.frame_name, prefix, prefix_size,
+                                      object->mime, sizeof(object->mime));
+    if (header_size == 0 || header_size > body_size) {
+        return false;
+    }
+    object->raw = context.body_raw;
+    object->body_size = context.body_size;
+    if (object->raw) {
+        object->offset = context.body_offset + header_size;
+        object->size = context.body_size - header_size;
+        object->skip = 0;
+    } else {
+        object->offset = context.body_offset;
+        object->size = SIZE_MAX;
+        object->skip = header_size;
+    }
+
+    MyHash64 hash;
+    size_t size = 0;
+    if (!scan_payload(file, *object, [&hash, &size](const char *ptr, size_t len) {
+        hash.Update(ptr, len);
+        size += len;
+    })) {
+        return false;
+    }
+    object->size = size;
+    object->hash = hash.Digest();
+    return true;
+}
+
+void format(const object_t& object, std::string& out) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "{DATA %s %s(%zx) size(%zx) xxh64(%016llx)}", object.mime,
+             object.raw ? "offset" : "unsync", object.offset, object.size,
+             static_cast<unsigned long long>(object.hash));
+    out += buf;
+}
+
+static const char *extension(const char *mime) {
+    if (strcasecmp(mime, "image/jpeg") == 0 || strcasecmp(mime, "image/jpg") == 0) {
+        return ".jpg";
+    }
+    if (strcasecmp(mime, "image/png") == 0) {
+        return ".png";
+    }
+    if (strcasecmp(mime, "image/gif") == 0) {
+        return ".gif";
+    }
+    return ".bin";
+}
+
+bool store(MyFile& file, const object_t& object, const char *dir) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(object.hash));
+    // fan out by the first byte of the hash
+    std::string path = std::string(dir) + "/" + std::string(name, 2);
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        perror(dir);
+        return false;
+    }
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+        perror(path.c_str());
+        return false;
+    }
+    path += std::string("/") + name + extension(object.mime);
+    if (access(path.c_str(), F_OK) == 0) {
+        return true;
+    }
+
+    // written under a temporary name, other threads may store the same
+    std::string tmp_path = path + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd < 0) {
+        perror(tmp_path.c_str());
+        return false;
+    }
+    bool written = true;
+    bool ok = scan_payload(file, object, [fd, &written](const char *ptr, size_t size) {
+        while (written && size > 0) {
+            ssize_t ret = write(fd, ptr, size);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                written = false;
+                break;
+            }
+            ptr += ret;
+            size -= ret;
+        }
+    });
+    ok = (close(fd) == 0) && ok && written;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        perror(path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace MyExtract
@@ -0,0 +1,31 @@
+#ifndef _MYEXTRACT_H_
+#define _MYEXTRACT_H_
+
+// Binary payloads of APIC, PIC and GEOB frames. They are located in the
+// file and hashed piece by piece, never copied as a whole, and can be
+// stored once by their hashes to de-duplicate the same pictures.
+namespace MyExtract {
+
+typedef struct {
+    size_t offset;      // of the payload in the file, or of the frame body if !raw
+    size_t size;        // of the payload
+    bool raw;           // false if the body is unsynchronized
+    size_t skip;        // bytes before the payload in the decoded body
+    size_t body_size;   // in the file
+    char mime[64];
+    uint64_t hash;      // XXH64 of the payload
+} object_t;
+
+bool is_object_frame(const char *frame_name);
+// Locates and hashes the payload of the frame. Returns false if there
+// is no payload, its header cannot be parsed, or the frame has data
+// added by the flags, like compression.
+bool locate(MyFile& file, const print_context_t& context, object_t *object);
+// Appends "{DATA mime offset(..) size(..) xxh64(..)}".
+void format(const object_t& object, std::string& out);
+// Writes the payload as dir/xx/<hash>.<ext>, unless it is already there.
+bool store(MyFile& file, const object_t& object, const char *dir);
+
+} // namespace MyExtract
+
+#endif /* _MYEXTRACT_H_ */
@@ -5,11 +5,175 @@
 #include <sys/mman.h>
 
 #include <string>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <functional>
 
 #include "myfile.h"
+#include "myarena.h"
+#include "mystats.h"
 
+// a page, for ID3v1 (128), ID3v1 enhanced (227) and usual sizes of
+// Lyrics3v2 and APEv2 before them (see MyTrailer)
+#define MYFILE_TAIL_WINDOW (4096)
+// pieces of Scan() without mmap
+#define MYFILE_SCAN_CHUNK (1024*1024)
 
-MyFile::MyFile(const char* f) : filesize(0), filename(f), ptr(nullptr) {
+
+class MyFileMmap : public MyFileBackend {
+public:
+    MyFileMmap(void *ptr, size_t size) : m_ptr(ptr), m_size(size) {
+    }
+    ~MyFileMmap() override {
+        munmap(m_ptr, m_size);
+    }
+    const char *Read(size_t offset, size_t) override {
+        return static_cast<const char*>(m_ptr) + offset;
+    }
+    // Big regions, like the whole audio, are read ahead more.
+    bool Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func) override {
+        size_t page = offset & ~static_cast<size_t>(4095);
+        madvise(static_cast<char*>(m_ptr) + page, size + (offset - page), MADV_SEQUENTIAL);
+        func(static_cast<const char*>(m_ptr) + offset, size);
+        return true;
+    }
+private:
+    void *m_ptr;
+    size_t m_size;
+};
+
+// Keeps every window read by pread(2), as callers may still hold
+// pointers into the older ones.
+class MyFilePread : public MyFileBackend {
+public:
+    MyFilePread(int fd, size_t size) : m_fd(fd), m_size(size) {
+    }
+    ~MyFilePread() override {
+        close(m_fd);
+    }
+    const char *Read(size_t offset, size_t size) override {
+        for (auto& elem : m_windows) {
+            if (elem.offset <= offset && offset + size <= elem.offset + elem.buf.size()) {
+                return elem.buf.data() + (offset - elem.offset);
+            }
+        }
+        // Trailing tags are probed several times with small reads,
+        // so read the whole tail window at once.
+        size_t read_offset = offset;
+        size_t read_size = size;
+        size_t tail_offset = (m_size > MYFILE_TAIL_WINDOW) ? m_size - MYFILE_TAIL_WINDOW : 0;
+        if (offset >= tail_offset) {
+            read_offset = tail_offset;
+            read_size = m_size - tail_offset;
+        }
+        MyStats::Timer timer(MyStats::STAGE_READ);
+        MyStats::Count(MyStats::COUNT_BYTES_READ, read_size);
+        window_t window {read_offset, std::vector<char>(read_size)};
+        for (size_t done = 0; done < read_size; ) {
+            ssize_t ret = pread(m_fd, window.buf.data() + done, read_size - done, read_offset + done);
+            if (ret < 0) {
+                perror("pread");
+                return nullptr;
+            }
+            if (ret == 0) {
+                // truncated while reading
+                return nullptr;
+            }
+            done += ret;
+        }
+        m_windows.push_back(std::move(window));
+        return m_windows.back().buf.data() + (offset - read_offset);
+    }
+    // not kept as windows, and read ahead more
+    bool Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func) override {
+        if (size > MYFILE_SCAN_CHUNK) {
+            posix_fadvise(m_fd, offset, size, POSIX_FADV_SEQUENTIAL);
+        }
+        MyArena::Scope scope;
+        char *buf = scope.Alloc(MYFILE_SCAN_CHUNK);
+        while (size > 0) {
+            size_t chunk = (size < MYFILE_SCAN_CHUNK) ? size : MYFILE_SCAN_CHUNK;
+            MyStats::Timer timer(MyStats::STAGE_READ);
+            MyStats::Count(MyStats::COUNT_BYTES_READ, chunk);
+            ssize_t ret = pread(m_fd, buf, chunk, offset);
+            if (ret < 0) {
+                perror("pread");
+                return false;
+            }
+            if (ret == 0) {
+                return false;
+            }
+            func(buf, ret);
+            offset += ret;
+            size -= ret;
+        }
+        return true;
+    }
+private:
+    typedef struct {
+        size_t offset;
+        std::vector<char> buf;
+    } window_t;
+    int m_fd;
+    size_t m_size;
+    std::deque<window_t> m_windows;
+};
+
+// Head and tail are read in advance (see MyPrefetch). Other regions
+// are read by reopening the file.
+class MyFileBuffer : public MyFileBackend {
+public:
+    MyFileBuffer(const std::string& filename, size_t size,
+                 std::vector<char>&& head, std::vector<char>&& tail)
+        : m_filename(filename), m_size(size), m_head(std::move(head)), m_tail(std::move(tail)) {
+    }
+    const char *Read(size_t offset, size_t size) override {
+        if (offset + size <= m_head.size()) {
+            return m_head.data() + offset;
+        }
+        size_t tail_offset = m_size - m_tail.size();
+        if (offset >= tail_offset) {
+            return m_tail.data() + (offset - tail_offset);
+        }
+        if (!OpenFallback()) {
+            return nullptr;
+        }
+        return m_fallback->Read(offset, size);
+    }
+    bool Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func) override {
+        if (offset + size <= m_head.size() || offset >= m_size - m_tail.size()) {
+            return MyFileBackend::Scan(offset, size, func);
+        }
+        if (!OpenFallback()) {
+            return false;
+        }
+        return m_fallback->Scan(offset, size, func);
+    }
+private:
+    bool OpenFallback() {
+        if (m_fallback == nullptr) {
+            int fd = open(m_filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                perror(m_filename.c_str());
+                return false;
+            }
+            m_fallback.reset(new MyFilePread(fd, m_size));
+        }
+        return true;
+    }
+    std::string m_filename;
+    size_t m_size;
+    std::vector<char> m_head;
+    std::vector<char> m_tail;
+    std::unique_ptr<MyFileBackend> m_fallback;
+};
+
+
+MyFile::MyFile(const char* f, backend_t backend) : filesize(0), filename(f) {
+    MyStats::Timer timer(MyStats::STAGE_OPEN);
     int fd = open(f, O_RDONLY);
     if (fd < 0) {
         perror(f);
@@ -18,21 +182,45 @@ MyFile::MyFile(const char* f) : filesize(0), filename(f), ptr(nullptr) {
     struct stat sz;
     if (fstat(fd, &sz) != 0) {
         perror(f);
+    } else if (backend == BACKEND_PREAD) {
+        if (sz.st_size > 0) {
+            filesize = sz.st_size;
+            m_backend.reset(new MyFilePread(fd, filesize));
+            // fd is owned by the backend
+            return;
+        }
     } else {
-        ptr = mmap(nullptr, sz.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        void *ptr = mmap(nullptr, sz.st_size, PROT_READ, MAP_SHARED, fd, 0);
         if(ptr == MAP_FAILED) {
             perror("mmap");
-            ptr = nullptr;
         } else {
             filesize = sz.st_size;
+            m_backend.reset(new MyFileMmap(ptr, filesize));
+            MyStats::Count(MyStats::COUNT_BYTES_MAPPED, filesize);
         }
     }
     close(fd);
 }
 
+MyFile::MyFile(const char *f, size_t size, std::vector<char>&& head_buf, std::vector<char>&& tail_buf)
+    : filesize(size), filename(f),
+      m_backend(new MyFileBuffer(filename, size, std::move(head_buf), std::move(tail_buf))) {
+}
+
+bool MyFile::Ready() const {
+    return m_backend != nullptr;
+}
+
+const char *MyFile::Read(size_t offset, size_t size) {
+    if (m_backend == nullptr || offset > filesize || size > filesize - offset) {
+        return nullptr;
+    }
+    return m_backend->Read(offset, size);
+}
 
-MyFile::~MyFile() {
-    if (ptr != nullptr) {
-        munmap(ptr, filesize);
+bool MyFile::Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func) {
+    if (m_backend == nullptr || offset > filesize || size > filesize - offset) {
+        return false;
     }
+    return m_backend->Scan(offset, size, func);
 }
@@ -1,12 +1,43 @@
 #ifndef _MYFILE_H_
 #define _MYFILE_H_
 
+// How MyFile brings file contents into memory.
+class MyFileBackend {
+public:
+    virtual ~MyFileBackend() {}
+    // returns nullptr if [offset, offset+size) cannot be read.
+    // Returned pointer is valid while the backend lives.
+    virtual const char *Read(size_t offset, size_t size) = 0;
+    // Passes [offset, offset+size) to func in pieces in order, which are
+    // not kept after func returns. Returns false if it cannot be read.
+    virtual bool Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func) {
+        const char *ptr = Read(offset, size);
+        if (ptr == nullptr) {
+            return false;
+        }
+        func(ptr, size);
+        return true;
+    }
+};
+
 struct MyFile {
-    MyFile(const char *f);
-    ~MyFile();
+    typedef enum {
+        BACKEND_MMAP,   // map whole file
+        BACKEND_PREAD,  // read only the requested windows
+    } backend_t;
+    MyFile(const char *f, backend_t backend = BACKEND_PREAD);
+    // only the head and the tail regions are already read into memory.
+    MyFile(const char *f, size_t size, std::vector<char>&& head_buf, std::vector<char>&& tail_buf);
+    bool Ready() const;
+    // returns nullptr if [offset, offset+size) is not accessible.
+    const char *Read(size_t offset, size_t size);
+    // Same as Read() but for big regions, like pictures. Mapped or
+    // already read bytes are passed as they are without copying.
+    bool Scan(size_t offset, size_t size, const std::function<void(const char*, size_t)>& func);
     size_t filesize;
     std::string filename;
-    void* ptr;
+private:
+    std::unique_ptr<MyFileBackend> m_backend;
 };
 
 #endif /* _MYFILE_H_ */
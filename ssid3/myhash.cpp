@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <cstring>
+
+#include "myhash.h"
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// little endian loads, as the hash is defined on them
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+MyHash64::MyHash64(uint64_t seed) : m_seed(seed), m_total(0), m_mem_size(0) {
+    m_acc[0] = seed + PRIME64_1 + PRIME64_2;
+    m_acc[1] = seed + PRIME64_2;
+    m_acc[2] = seed;
+    m_acc[3] = seed - PRIME64_1;
+}
+
+void MyHash64::Update(const char *buf, size_t size) {
+    auto p = reinterpret_cast<const unsigned char*>(buf);
+    auto end = p + size;
+    m_total += size;
+    if (m_mem_size + size < sizeof(m_mem)) {
+        memcpy(m_mem + m_mem_size, p, size);
+        m_mem_size += size;
+        return;
+    }
+    if (m_mem_size > 0) {
+        size_t fill = sizeof(m_mem) - m_mem_size;
+        memcpy(m_mem + m_mem_size, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; i++) {
+            m_acc[i] = round(m_acc[i], read64(m_mem + 8*i));
+        }
+        m_mem_size = 0;
+    }
+    for (; p + 32 <= end; p += 32) {
+        m_acc[0] = round(m_acc[0], read64(p));
+        m_acc[1] = round(m_acc[1], read64(p + 8));
+        m_acc[2] = round(m_acc[2], read64(p + 16));
+        m_acc[3] = round(m_acc[3], read64(p + 24));
+    }
+    m_mem_size = end - p;
+    memcpy(m_mem, p, m_mem_size);
+}
+
+uint64_t MyHash64::Digest() const {
+    uint64_t h;
+    if (m_total >= 32) {
+        h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) + rotl(m_acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = merge_round(h, m_acc[i]);
+        }
+    } else {
+        h = m_seed + PRIME64_5;
+    }
+    h += m_total;
+
+    const unsigned char *p = m_mem;
+    const unsigned char *end = m_mem + m_mem_size;
+    for (; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+        h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t MyHash64::Hash(const char *buf, size_t size, uint64_t seed) {
+    MyHash64 hash(seed);
+    hash.Update(buf, size);
+    return hash.Digest();
+}
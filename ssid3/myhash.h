@@ -0,0 +1,19 @@
+#ifndef _MYHASH_H_
+#define _MYHASH_H_
+
+// XXH64 of xxHash, fed in chunks of any size.
+class MyHash64 {
+public:
+    explicit MyHash64(uint64_t seed = 0);
+    void Update(const char *buf, size_t size);
+    uint64_t Digest() const;
+    static uint64_t Hash(const char *buf, size_t size, uint64_t seed = 0);
+private:
+    uint64_t m_seed;
+    uint64_t m_acc[4];
+    uint64_t m_total;
+    unsigned char m_mem[32];    // input not yet in a stripe
+    size_t m_mem_size;
+};
+
+#endif /* _MYHASH_H_ */
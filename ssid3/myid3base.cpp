@@ -1,6 +1,8 @@
 #include <string>
 #include <memory>
+#include <vector>
 #include <functional>
+#include <utility>
 
 #include <iconv.h>
 
@@ -9,6 +11,6 @@
 #include "myid3base.h"
 
 
-MyID3Base::MyID3Base(std::shared_ptr<MyFile> file) : m_file(file) {
+MyID3Base::MyID3Base(std::shared_ptr<MyFile> file) : m_file(std::move(file)), m_need_text(true) {
 }
 
@@ -5,11 +5,22 @@ class MyID3Base {
 protected:
     MyID3Base(std::shared_ptr<MyFile> file);
     std::shared_ptr<MyFile> m_file;
+    bool m_need_text;
 public:
     virtual void Analyze(const std::function<void(const print_context_t&)>) = 0;
+    // If false, frame_body may be left empty for the frames whose body
+    // is raw in the file (body_raw), as the caller reads it by itself.
+    void SetNeedText(bool need_text) { m_need_text = need_text; }
+    // Same as Analyze(). Subclasses hide this to let sink be inlined.
+    template<class Sink>
+    void AnalyzeWith(Sink&& sink) { Analyze(sink); }
+    // If the file is to be analyzed at all.
+    static bool IsTarget(const MyFile& file) {
+        return file.filename.find(".mp3") != std::string::npos;
+    }
     template<class T>
     static std::shared_ptr<MyID3Base> Create(std::shared_ptr<MyFile> file) {
-        if (file->filename.find(".mp3") == std::string::npos) {
+        if (!IsTarget(*file)) {
             return nullptr;
         }
         std::shared_ptr<MyID3Base> retptr;
@@ -1,11 +1,16 @@
 #include <string>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <vector>
 
 #include <iconv.h>
 
 #include "myid3util.h"
+#include "mycharset.h"
+#include "myarena.h"
+#include "mystats.h"
 
 
 namespace MyID3Util {
@@ -230,6 +235,14 @@ size_t char_length_by_byte(const char *text, unsigned char encode) {
     }
 }
 
+size_t parse_syncsafe(const unsigned char *p) {
+    return
+        ((p[0] & 0x7f) << 21) +
+        ((p[1] & 0x7f) << 14) +
+        ((p[2] & 0x7f) << 7) +
+        ((p[3] & 0x7f) << 0);
+}
+
 bool is_valid_frame_text(const char *text, size_t size) {
     for(size_t i=0; i<size; i++) {
         if (!isalnum(text[i])) {
@@ -256,7 +269,48 @@ char *strcpy_hex(char *dest, const char *src) {
     return retval;
 }
 
+// iconv_open() is much more expensive than iconv() itself, so keep
+// descriptors opened for each thread.
+class IconvCache {
+public:
+    ~IconvCache() {
+        for (auto& elem : m_entries) {
+            if (elem.ic != reinterpret_cast<iconv_t>(-1)) {
+                iconv_close(elem.ic);
+            }
+        }
+    }
+    iconv_t Get(const char *tocode, const char *fromcode) {
+        for (auto& elem : m_entries) {
+            if (elem.to == tocode && elem.from == fromcode) {
+                return elem.ic;
+            }
+        }
+        // failure is also cached
+        m_entries.push_back({tocode, fromcode, iconv_open(tocode, fromcode)});
+        return m_entries.back().ic;
+    }
+private:
+    typedef struct {
+        std::string to;
+        std::string from;
+        iconv_t ic;
+    } entry_t;
+    std::vector<entry_t> m_entries;
+};
+
+iconv_t iconv_get(const char *tocode, const char *fromcode) {
+    thread_local IconvCache cache;
+    iconv_t ic = cache.Get(tocode, fromcode);
+    if (ic != reinterpret_cast<iconv_t>(-1)) {
+        // reset the shift state left by the previous use.
+        iconv(ic, nullptr, nullptr, nullptr, nullptr);
+    }
+    return ic;
+}
+
 char *strcpy_charcode(char *dest, const char *src, size_t src_len, const char *charcode) {
+    MyStats::Timer timer(MyStats::STAGE_CHARSET);
     if (strcasecmp(charcode, "ASCII") == 0 ||
         strcasecmp(charcode, "UTF-8") == 0) {
         return strcpy(dest, src);
@@ -269,7 +323,7 @@ char *strcpy_charcode(char *dest, const char *src, size_t src_len, const char *c
         // so keep src_len
     }
 
-    iconv_t ic = iconv_open("UTF-8", charcode);
+    iconv_t ic = iconv_get("UTF-8", charcode);
     if (ic == reinterpret_cast<iconv_t>(-1)) {
         return nullptr;
     }
@@ -279,7 +333,6 @@ char *strcpy_charcode(char *dest, const char *src, size_t src_len, const char *c
     char *out_p = &dest[0];
 
     auto retval = iconv(ic, &in_p, &src_len, &out_p, &out_len);
-    iconv_close(ic);
     if (retval == static_cast<size_t>(-1)) {
         return nullptr;
     }
@@ -287,40 +340,17 @@ char *strcpy_charcode(char *dest, const char *src, size_t src_len, const char *c
     return dest;
 }
 
-static bool is_maybe_8859(const char *src) {
-    for (const char *p = src; ; p++) {
-        // fetch
-        unsigned char pval = *p;
-        if (pval == '\0') {
-            break;
-        } else if ((0x20 <= pval && pval <= 0x7e) ||
-                   (0xa0 <= pval /* always true && pval <= 0xff */)) {
-            // OK
-        } else {
-            return false;
-        }
-    }
-    return true;
-}
-
 bool is_maybe_ascii(const char *src) {
-    for (const char *p = src; ; p++) {
-        // fetch
-        char pval = *p;
-        if (pval == '\0') {
-            break;
-        } else if (!isprint(pval)) {
-            return false;
-        }
-    }
-    return true;
+    return MyCharset::score(MyCharset::CHARSET_ASCII, src, strlen(src)) > 0;
 }
 
 bool is_maybe_charcode(const char *src, size_t src_len, const char *charcode) {
-    if (strcasecmp(charcode, "ASCII") == 0) {
-        return is_maybe_ascii(src);
+    MyCharset::charset_t cs;
+    if (MyCharset::find(charcode, &cs)) {
+        return MyCharset::score(cs, src, src_len) > 0;
     }
 
+    // not known by MyCharset, try to convert with iconv.
     if(memcmp(charcode, "UTF-16", 6) != 0) {
         src_len = 1 + strlen(src);
     } else {
@@ -328,18 +358,17 @@ bool is_maybe_charcode(const char *src, size_t src_len, const char *charcode) {
         // so keep src_len
     }
 
-    iconv_t ic = iconv_open(charcode, charcode);
+    iconv_t ic = iconv_get(charcode, charcode);
     if (ic == reinterpret_cast<iconv_t>(-1)) {
         return false;
     }
 
     char *in_p = const_cast<char*>(src);
     auto out_len = src_len;
-    char buf[out_len];
-    char *out_p = &buf[0];
+    MyArena::Scope scope;
+    char *out_p = scope.Alloc(out_len);
 
     auto retval = iconv(ic, &in_p, &src_len, &out_p, &out_len);
-    iconv_close(ic);
     if (retval == static_cast<size_t>(-1)) {
         return false;
     }
@@ -347,33 +376,30 @@ bool is_maybe_charcode(const char *src, size_t src_len, const char *charcode) {
 }
 
 bool detect_charcode(const char *src, size_t src_len, char *charcode) {
-    if (is_maybe_ascii(src)) {
-        strcpy(charcode, "ASCII");
-        return true;
-    }
-
-    const std::vector<const char*> code_table = {
-        "UTF-8",
-        "CP932",
-        "UTF-16",
-#if 0
-        // It seems always success to convert from "ISO-8859-1" using iconv.
-        // So I prepared my original code checker.
-        "ISO-8859-1",
-#endif
+    MyStats::Timer timer(MyStats::STAGE_CHARSET);
+    MyStats::Count(MyStats::COUNT_CHARSET_DETECTS);
+    // Highest confidence wins. On a tie, earlier one wins.
+    const MyCharset::charset_t code_table[] = {
+        MyCharset::CHARSET_ASCII,
+        MyCharset::CHARSET_UTF8,
+        MyCharset::CHARSET_CP932,
+        MyCharset::CHARSET_UTF16,
+        MyCharset::CHARSET_8859,
     };
-    for ( auto elem : code_table) {
-        if (is_maybe_charcode(src, src_len, elem)) {
-            strcpy (charcode, elem);
-            return true;
+    int best_score = 0;
+    const char *best = nullptr;
+    for (auto elem : code_table) {
+        int score = MyCharset::score(elem, src, src_len);
+        if (score > best_score) {
+            best_score = score;
+            best = MyCharset::name(elem);
         }
     }
-
-    if (is_maybe_8859(src)) {
-        strcpy(charcode, "ISO-8859-1");
-        return true;
+    if (best == nullptr) {
+        return false;
     }
-    return false;
+    strcpy(charcode, best);
+    return true;
 }
 
 
@@ -6,7 +6,12 @@ namespace MyID3Util {
 const char *genre_name(unsigned char genre_code);
 size_t char_length_by_byte(const char *text, unsigned char encode);
 bool is_valid_frame_text(const char *text, size_t size);
+// 28 bits of the 4-byte syncsafe integer, used for tag and v2.4 frame sizes
+size_t parse_syncsafe(const unsigned char *p);
 char *strcpy_hex(char *dest, const char *src);
+// Returns the iconv descriptor cached for the calling thread, already reset.
+// Do not iconv_close() it.
+iconv_t iconv_get(const char *tocode, const char *fromcode);
 char *strcpy_charcode(char *dest, const char *src, size_t src_len, const char *charcode);
 bool is_maybe_ascii(const char *src);
 bool is_maybe_charcode(const char *src, size_t src_len, const char *charcode);
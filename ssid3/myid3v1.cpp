@@ -3,31 +3,46 @@
 #include <memory>
 #include <vector>
 #include <functional>
+#include <utility>
+
+#include <iconv.h>
 
 #include "ssid3.h"
 #include "myfile.h"
 #include "myid3base.h"
 #include "myid3v1.h"
 #include "myid3util.h"
+#include "myarena.h"
+#include "mytrailer.h"
 
 const size_t MyID3V1::ID3V1_FRAME_SIZE = 128;
 
-MyID3V1::MyID3V1(std::shared_ptr<MyFile> file) : MyID3Base(file) {
+MyID3V1::MyID3V1(std::shared_ptr<MyFile> file) : MyID3Base(std::move(file)), m_tag(nullptr), m_offset(0) {
 }
 
 bool MyID3V1::AnalyzeHeader(const std::function<void(const print_context_t&)> func) {
     char print_buf[64];
-    print_context_t context {m_file->filesize - ID3V1_FRAME_SIZE, 3,
-        "HEAD", print_buf, m_file->filename.c_str()};
+    print_context_t context {0, 3, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
 
     if (m_file->filesize < ID3V1_FRAME_SIZE) {
-        context.offset = 0;
         sprintf (print_buf, "filesize %zd < %zd", m_file->filesize, ID3V1_FRAME_SIZE);
         func(context);
         return false;
     }
 
-    const char *tag_pos = static_cast<const char*>(m_file->ptr) + context.offset;
+    // APEv2 or Lyrics3v2 may be after ID3v1, otherwise it is at the end.
+    MyTrailer::trailers_t trailers;
+    MyTrailer::locate(*m_file, &trailers);
+    auto trailer = MyTrailer::find(trailers, MyTrailer::TRAILER_ID3V1);
+    m_offset = (trailer != nullptr) ? trailer->offset : m_file->filesize - ID3V1_FRAME_SIZE;
+    context.offset = m_offset;
+    m_tag = m_file->Read(context.offset, ID3V1_FRAME_SIZE);
+    if (m_tag == nullptr) {
+        strcpy(print_buf, "cannot read tail");
+        func(context);
+        return false;
+    }
+    const char *tag_pos = m_tag;
     const char tag_base[] = "TAG";
     char tag_buf[sizeof(tag_base)];
     memset (tag_buf, 0, sizeof(tag_buf));
@@ -43,13 +58,15 @@ bool MyID3V1::AnalyzeHeader(const std::function<void(const print_context_t&)> fu
 
 bool MyID3V1::AnalyzeEnhance(const std::function<void(const print_context_t&)> func) {
     char print_buf[64];
-    size_t search_offset = 227 + ID3V1_FRAME_SIZE;
-    print_context_t context {m_file->filesize - search_offset,
-        4, "ENHANCE", print_buf, m_file->filename.c_str()};
-    if (m_file->filesize < search_offset) {
+    print_context_t context {m_offset - 227,
+        4, "ENHANCE", print_buf, m_file->filename.c_str(), 0, 0, false};
+    if (m_offset < 227) {
+        return false;
+    }
+    const char *tag_pos = m_file->Read(context.offset, 4);
+    if (tag_pos == nullptr) {
         return false;
     }
-    const char *tag_pos = static_cast<const char*>(m_file->ptr) + context.offset;
     const char tag_base[] = "TAG+";
     char tag_buf[sizeof(tag_base)];
     memset (tag_buf, 0, sizeof(tag_buf));
@@ -65,14 +82,16 @@ bool MyID3V1::AnalyzeEnhance(const std::function<void(const print_context_t&)> f
 void MyID3V1::AnalyzeString(const std::function<void(const print_context_t&)> func,
                             const char *frame_name, size_t offset, size_t size) {
     char print_buf[128];
-    print_context_t context {m_file->filesize - ID3V1_FRAME_SIZE + offset,
-        size, frame_name, print_buf, m_file->filename.c_str()};
+    print_context_t context {m_offset + offset,
+        size, frame_name, print_buf, m_file->filename.c_str(),
+        m_offset + offset, size, true};
 
-    const char *tag_pos = static_cast<const char*>(m_file->ptr) + context.offset;
+    const char *tag_pos = m_tag + offset;
     // care for UTF-16's null terminator
-    char tag_buf[size+2];
-    memset (tag_buf, 0, sizeof(tag_buf));
+    MyArena::Scope scope;
+    char *tag_buf = scope.Alloc(size+2);
     memcpy (tag_buf, tag_pos, size);
+    tag_buf[size] = tag_buf[size+1] = '\0';
 
     char charcode[16];
     if (tag_buf[0] == '\0') {
@@ -109,17 +128,17 @@ void MyID3V1::AnalyzeString(const std::function<void(const print_context_t&)> fu
 void MyID3V1::AnalyzeInt(const std::function<void(const print_context_t&)> func,
                          const char *frame_name, size_t offset, size_t size) {
     char print_buf[16];
-    print_context_t context {m_file->filesize - ID3V1_FRAME_SIZE + offset,
-        size, frame_name, print_buf, m_file->filename.c_str()};
+    print_context_t context {m_offset + offset,
+        size, frame_name, print_buf, m_file->filename.c_str(),
+        m_offset + offset, size, true};
 
-    const unsigned char *int_pos = static_cast<const unsigned char*>(m_file->ptr) + context.offset;
+    const unsigned char *int_pos = reinterpret_cast<const unsigned char*>(m_tag) + offset;
     sprintf(print_buf, "%d", *int_pos);
     func(context);
 }
 
 void MyID3V1::AnalyzeTrack(const std::function<void(const print_context_t&)> func) {
-    const char *tag_pos = static_cast<const char*>(m_file->ptr) + m_file->filesize
-        - ID3V1_FRAME_SIZE + 125;
+    const char *tag_pos = m_tag + 125;
     if (*tag_pos == '\0') {
         AnalyzeInt(func, "track", 126, 1);
     }
@@ -127,9 +146,10 @@ void MyID3V1::AnalyzeTrack(const std::function<void(const print_context_t&)> fun
 
 void MyID3V1::AnalyzeGenre(const std::function<void(const print_context_t&)> func) {
     char print_buf[64];
-    print_context_t context {m_file->filesize - ID3V1_FRAME_SIZE + 127,
-        1, "Genre", print_buf, m_file->filename.c_str()};
-    unsigned char genre_code = *(static_cast<const unsigned char*>(m_file->ptr) + context.offset);
+    print_context_t context {m_offset + 127,
+        1, "Genre", print_buf, m_file->filename.c_str(),
+        m_offset + 127, 1, true};
+    unsigned char genre_code = static_cast<unsigned char>(m_tag[127]);
     sprintf(print_buf, "{%s}%d", MyID3Util::genre_name(genre_code), genre_code);
 
     func(context);
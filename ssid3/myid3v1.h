@@ -17,6 +17,8 @@ private:
                     const char *frame_name, size_t offset, size_t size);
     void AnalyzeTrack(const std::function<void(const print_context_t&)> func);
     void AnalyzeGenre(const std::function<void(const print_context_t&)> func);
+    const char *m_tag;
+    size_t m_offset;    // of "TAG"
 };
 
 #endif /* _MYID3V1_H_ */
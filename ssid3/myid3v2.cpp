@@ -1,169 +1,282 @@
 #include <string>
+#include <cstdio>
+#include <cstdint>
 #include <cstring>
 #include <memory>
+#include <vector>
 #include <functional>
-#include <unordered_map>
+#include <utility>
+#include <bitset>
+
+#include <iconv.h>
+#include <zlib.h>
 
 #include "ssid3.h"
 #include "myfile.h"
 #include "myid3base.h"
+#include "myarena.h"
 #include "myid3v2.h"
 #include "myid3util.h"
+#include "myunsync.h"
+#include "mystats.h"
+#include "mytrailer.h"
 
 //#define UNSYNCH_DEBUG (1)
 
 typedef struct {
+    const char *id;
     const char *name_desc;
     void(*func)(char*,const char*,size_t);
 } id3v2_frame_entry_t;
 
 // for ID3v2 v2.2
-static const std::unordered_map<std::string, id3v2_frame_entry_t> frame_entry_tbl_v2 = {
-    {"TT2", {"title", MyID3V2::AnalyzeString}},
-    {"TP1", {"artist", MyID3V2::AnalyzeString}},
-    {"TAL", {"album", MyID3V2::AnalyzeString}},
-    {"TYE", {"year", MyID3V2::AnalyzeString}},
-    {"TCM", {"composer", MyID3V2::AnalyzeString}},
-    {"TPA", {"setof", MyID3V2::AnalyzeString}},
-    {"TP2", {"performer", MyID3V2::AnalyzeString}},
-    {"COM", {"comment", MyID3V2::AnalyzeString}},
-    {"TRK", {"track", MyID3V2::AnalyzeString}},
-    {"TCO", {"ctype", MyID3V2::AnalyzeString}},
-    {"TEN", {"encode", MyID3V2::AnalyzeString}},
-    {"TSS", {"setting", MyID3V2::AnalyzeString}},
-    {"TDA", {"date", MyID3V2::AnalyzeString}},
-    {"TIM", {"time", MyID3V2::AnalyzeString}},
-    {"TKE", {"music key", MyID3V2::AnalyzeString}},
+static constexpr id3v2_frame_entry_t frame_entry_tbl_v2[] = {
+    {"TT2", "title", MyID3V2::AnalyzeString},
+    {"TP1", "artist", MyID3V2::AnalyzeString},
+    {"TAL", "album", MyID3V2::AnalyzeString},
+    {"TYE", "year", MyID3V2::AnalyzeString},
+    {"TCM", "composer", MyID3V2::AnalyzeString},
+    {"TPA", "setof", MyID3V2::AnalyzeString},
+    {"TP2", "performer", MyID3V2::AnalyzeString},
+    {"COM", "comment", MyID3V2::AnalyzeString},
+    {"TRK", "track", MyID3V2::AnalyzeString},
+    {"TCO", "ctype", MyID3V2::AnalyzeString},
+    {"TEN", "encode", MyID3V2::AnalyzeString},
+    {"TSS", "setting", MyID3V2::AnalyzeString},
+    {"TDA", "date", MyID3V2::AnalyzeString},
+    {"TIM", "time", MyID3V2::AnalyzeString},
+    {"TKE", "music key", MyID3V2::AnalyzeString},
     // complex part
-    {"ULT", {"lyrics", MyID3V2::AnalyzeUSLT}},
+    {"ULT", "lyrics", MyID3V2::AnalyzeUSLT},
     // including binary data
-    {"PIC", {"picture", MyID3V2::AnalyzeString}},
+    {"PIC", "picture", MyID3V2::AnalyzeString},
 };
 
 // for ID3v2 v2.3 v2.4
-static std::unordered_map<std::string, id3v2_frame_entry_t> frame_entry_tbl_common = {
-    {"TIT1", {"group", MyID3V2::AnalyzeString}},
-    {"TIT2", {"title", MyID3V2::AnalyzeString}},
-    {"TPE1", {"artist", MyID3V2::AnalyzeString}},
-    {"TPE2", {"artist2", MyID3V2::AnalyzeString}},
-    {"TALB", {"album", MyID3V2::AnalyzeString}},
-    {"TPOS", {"set of", MyID3V2::AnalyzeString}},
-    {"TYER", {"year", MyID3V2::AnalyzeString}},
-    {"TRCK", {"track", MyID3V2::AnalyzeString}},
-    {"TCON", {"ctype", MyID3V2::AnalyzeString}},
-    {"TCOP", {"copyright", MyID3V2::AnalyzeString}},
-    {"TENC", {"encode", MyID3V2::AnalyzeString}},
-    {"WXXX", {"user url", MyID3V2::AnalyzeString}},
-    {"TOPE", {"o art", MyID3V2::AnalyzeString}},
-    {"TCOM", {"composer", MyID3V2::AnalyzeString}},
-    {"TMED", {"mtype",  MyID3V2::AnalyzeString}},
-    {"TLEN", {"length",  MyID3V2::AnalyzeString}},
-    {"TSSE", {"setting", MyID3V2::AnalyzeString}},
-    {"TXXX", {"user def", MyID3V2::AnalyzeString}},
-    {"TDRC", {"rec time", MyID3V2::AnalyzeString}},
-    {"TBPM", {"bpm", MyID3V2::AnalyzeString}},
-    {"TEXT", {"writer", MyID3V2::AnalyzeString}},
-    {"TDEN", {"enc time", MyID3V2::AnalyzeString}},
-    {"TDTG", {"tag time", MyID3V2::AnalyzeString}},
-    {"TPUB", {"publisher", MyID3V2::AnalyzeString}},
-    {"TIME", {"time", MyID3V2::AnalyzeString}},
-    {"TKEY", {"music key", MyID3V2::AnalyzeString}},
-    {"TDAT", {"date", MyID3V2::AnalyzeString}},
-    {"TFLT", {"file type", MyID3V2::AnalyzeString}},
-    {"TSOP", {"perf sort", MyID3V2::AnalyzeString}},
-    {"TOFN", {"orig filename", MyID3V2::AnalyzeString}},
+static constexpr id3v2_frame_entry_t frame_entry_tbl_common[] = {
+    {"TIT1", "group", MyID3V2::AnalyzeString},
+    {"TIT2", "title", MyID3V2::AnalyzeString},
+    {"TPE1", "artist", MyID3V2::AnalyzeString},
+    {"TPE2", "artist2", MyID3V2::AnalyzeString},
+    {"TALB", "album", MyID3V2::AnalyzeString},
+    {"TPOS", "set of", MyID3V2::AnalyzeString},
+    {"TYER", "year", MyID3V2::AnalyzeString},
+    {"TRCK", "track", MyID3V2::AnalyzeString},
+    {"TCON", "ctype", MyID3V2::AnalyzeString},
+    {"TCOP", "copyright", MyID3V2::AnalyzeString},
+    {"TENC", "encode", MyID3V2::AnalyzeString},
+    {"WXXX", "user url", MyID3V2::AnalyzeString},
+    {"TOPE", "o art", MyID3V2::AnalyzeString},
+    {"TCOM", "composer", MyID3V2::AnalyzeString},
+    {"TMED", "mtype", MyID3V2::AnalyzeString},
+    {"TLEN", "length", MyID3V2::AnalyzeString},
+    {"TSSE", "setting", MyID3V2::AnalyzeString},
+    {"TXXX", "user def", MyID3V2::AnalyzeString},
+    {"TDRC", "rec time", MyID3V2::AnalyzeString},
+    {"TBPM", "bpm", MyID3V2::AnalyzeString},
+    {"TEXT", "writer", MyID3V2::AnalyzeString},
+    {"TDEN", "enc time", MyID3V2::AnalyzeString},
+    {"TDTG", "tag time", MyID3V2::AnalyzeString},
+    {"TPUB", "publisher", MyID3V2::AnalyzeString},
+    {"TIME", "time", MyID3V2::AnalyzeString},
+    {"TKEY", "music key", MyID3V2::AnalyzeString},
+    {"TDAT", "date", MyID3V2::AnalyzeString},
+    {"TFLT", "file type", MyID3V2::AnalyzeString},
+    {"TSOP", "perf sort", MyID3V2::AnalyzeString},
+    {"TOFN", "orig filename", MyID3V2::AnalyzeString},
     // no character decoding required
-    {"PRIV", {"private", MyID3V2::AnalyzeSimpleChar}},
-    {"WOAR", {"official url", MyID3V2::AnalyzeSimpleChar}},
-    {"UFID", {"uniq file", MyID3V2::AnalyzeSimpleChar}},
-    {"WCOM", {"cm url", MyID3V2::AnalyzeSimpleChar}},
-    {"WCOP", {"copyright", MyID3V2::AnalyzeSimpleChar}},
-    {"WOAF", {"official url", MyID3V2::AnalyzeSimpleChar}},
-    {"WOAS", {"official url", MyID3V2::AnalyzeSimpleChar}},
-    {"WPAY", {"pay url", MyID3V2::AnalyzeSimpleChar}},
-    {"WORS", {"radio url", MyID3V2::AnalyzeSimpleChar}},
-    {"WPUB", {"publish url", MyID3V2::AnalyzeSimpleChar}},
+    {"PRIV", "private", MyID3V2::AnalyzeSimpleChar},
+    {"WOAR", "official url", MyID3V2::AnalyzeSimpleChar},
+    {"UFID", "uniq file", MyID3V2::AnalyzeSimpleChar},
+    {"WCOM", "cm url", MyID3V2::AnalyzeSimpleChar},
+    {"WCOP", "copyright", MyID3V2::AnalyzeSimpleChar},
+    {"WOAF", "official url", MyID3V2::AnalyzeSimpleChar},
+    {"WOAS", "official url", MyID3V2::AnalyzeSimpleChar},
+    {"WPAY", "pay url", MyID3V2::AnalyzeSimpleChar},
+    {"WORS", "radio url", MyID3V2::AnalyzeSimpleChar},
+    {"WPUB", "publish url", MyID3V2::AnalyzeSimpleChar},
     // including binary data
-    {"APIC", {"picture", MyID3V2::AnalyzeSimpleChar}},
-    {"GEOB", {"encapsul", MyID3V2::AnalyzeGEOB}},
-    {"USLT", {"lyrics", MyID3V2::AnalyzeUSLT}},
-    {"COMM", {"comment", MyID3V2::AnalyzeUSLT}}, // format same as USLT
+    {"APIC", "picture", MyID3V2::AnalyzeSimpleChar},
+    {"GEOB", "encapsul", MyID3V2::AnalyzeGEOB},
+    {"USLT", "lyrics", MyID3V2::AnalyzeUSLT},
+    {"COMM", "comment", MyID3V2::AnalyzeUSLT}, // format same as USLT
+    // where the next tag is
+    {"SEEK", "seek", MyID3V2::AnalyzeSEEK},
     // TOC binary data.
-    {"MCDI", {"music cd id", MyID3V2::AnalyzeSimpleChar}},
+    {"MCDI", "music cd id", MyID3V2::AnalyzeSimpleChar},
     // iTunes specific ?
-    {"TCMP", {"iTunes", MyID3V2::AnalyzeString}},
+    {"TCMP", "iTunes", MyID3V2::AnalyzeString},
     // unclear frame tag
-    {"XIMP", {"ximp", MyID3V2::AnalyzeString}},
+    {"XIMP", "ximp", MyID3V2::AnalyzeString},
     // unclear frame tag
-    {"YIMP", {"yimp", MyID3V2::AnalyzeString}},
+    {"YIMP", "yimp", MyID3V2::AnalyzeString},
 };
 
-MyID3V2::MyID3V2(std::shared_ptr<MyFile> file)
-    : MyID3Base(file),
-      m_id3v2_header(static_cast<id3v2_header_t*>(file->ptr)),
-      m_version(0), m_header_size(0), m_total_size(0)
-{
+// pack 3 or 4 chars of frame ID into big endian integer
+static constexpr uint32_t PackFrameID(const char *id, size_t len) {
+    uint32_t key = 0;
+    for (size_t i = 0; i < len; i++) {
+        key = (key << 8) | static_cast<unsigned char>(id[i]);
+    }
+    return key;
 }
 
-size_t MyID3V2::ParseSyncSafeSize(const unsigned char *size) {
-    return
-        ((size[0] & 0x7f) << 14) +
-        ((size[1] & 0x7f) << 7) +
-        ((size[2] & 0x7f) << 0);
+static constexpr size_t FrameIDLength(const char *id) {
+    size_t len = 0;
+    while (id[len] != '\0') {
+        len++;
+    }
+    return len;
 }
 
-size_t MyID3V2::ParseDirectSize(const unsigned char *size) {
-    return (size[0] << 16) + (size[1] << 8) + (size[2] << 0);
+// Perfect hash on the packed frame ID, the seed is searched at compile time.
+template<unsigned BITS>
+struct frame_hash_t {
+    uint32_t seed;
+    uint32_t key[1<<BITS];
+    int index[1<<BITS];
+
+    constexpr size_t Slot(uint32_t k) const {
+        return static_cast<uint32_t>(k * seed) >> (32 - BITS);
+    }
+    constexpr int Find(uint32_t k) const {
+        size_t slot = Slot(k);
+        return (key[slot] == k) ? index[slot] : -1;
+    }
+};
+
+template<unsigned BITS, size_t N>
+static constexpr frame_hash_t<BITS> MakeFrameHash(const id3v2_frame_entry_t (&tbl)[N]) {
+    frame_hash_t<BITS> hash {};
+    for (hash.seed = 0x9e3779b1; ; hash.seed += 2) {
+        bool collided = false;
+        for (size_t i = 0; i < (1u<<BITS); i++) {
+            hash.key[i] = 0;
+            hash.index[i] = -1;
+        }
+        for (size_t i = 0; i < N && !collided; i++) {
+            uint32_t k = PackFrameID(tbl[i].id, FrameIDLength(tbl[i].id));
+            size_t slot = hash.Slot(k);
+            if (hash.index[slot] >= 0) {
+                collided = true;
+            }
+            hash.key[slot] = k;
+            hash.index[slot] = i;
+        }
+        if (!collided) {
+            return hash;
+        }
+    }
 }
 
-size_t MyID3V2::DecodeUnsynchronizedBuf(const char *inbuf_arg, size_t size, char *outbuf_arg) {
-	// first byte should always be coied.
-	auto inbuf = reinterpret_cast<unsigned const char*>(inbuf_arg);
-	auto outbuf = reinterpret_cast<unsigned char*>(outbuf_arg);
-	outbuf[0] = inbuf[0];
-	size_t i = 1;
-	for(size_t p=1; p<size; ) {
-		if (inbuf[i-1] == 0xff && inbuf[i] == 0x00) {
-			// decode unsynchronized data "0xff00xx" -> "0xffxx"
-			i++;
-			continue;
-		}
-		outbuf[p] = inbuf[i];
-		p++;
-		i++;
-	}
-	return (i-size);
+#define TBL_COUNT(tbl) (sizeof(tbl)/sizeof(tbl[0]))
+static constexpr auto frame_hash_v2 = MakeFrameHash<6>(frame_entry_tbl_v2);
+static constexpr auto frame_hash_common = MakeFrameHash<8>(frame_entry_tbl_common);
+static_assert(TBL_COUNT(frame_entry_tbl_v2) <= ID3V2_FRAME_TBL_BITS, "too many frames");
+static_assert(TBL_COUNT(frame_entry_tbl_common) <= ID3V2_FRAME_TBL_BITS, "too many frames");
+static_assert(frame_hash_common.Find(PackFrameID("TIT2", 4)) >= 0, "broken frame hash");
+
+bool MyID3V2::CompileProjection(const char *list, id3v2_projection_t *proj) {
+    proj->v2.reset();
+    proj->common.reset();
+    std::string str(list);
+    for (size_t pos = 0; pos <= str.size(); ) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        std::string id = str.substr(pos, end - pos);
+        pos = end + 1;
+        if (id.empty()) {
+            continue;
+        }
+        int elem_v2 = (id.size() == 3) ? frame_hash_v2.Find(PackFrameID(id.c_str(), 3)) : -1;
+        int elem = (id.size() == 4) ? frame_hash_common.Find(PackFrameID(id.c_str(), 4)) : -1;
+        if (elem_v2 >= 0) {
+            proj->v2.set(elem_v2);
+        } else if (elem >= 0) {
+            proj->common.set(elem);
+            // also select the v2.2 frame for the same thing (e.g. TIT2 -> TT2)
+            const char *desc = frame_entry_tbl_common[elem].name_desc;
+            for (size_t i = 0; i < TBL_COUNT(frame_entry_tbl_v2); i++) {
+                if (strcmp(frame_entry_tbl_v2[i].name_desc, desc) == 0) {
+                    proj->v2.set(i);
+                }
+            }
+        } else {
+            fprintf(stderr, "unknown frame %s\n", id.c_str());
+            return false;
+        }
+    }
+    return true;
 }
 
-size_t MyID3V2::ParseVerDependSize(const unsigned char *size) {
+void MyID3V2::SetProjection(const id3v2_projection_t *proj) {
+    m_projection = proj;
+}
+
+MyID3V2::MyID3V2(std::shared_ptr<MyFile> file)
+    : MyID3Base(std::move(file)),
+      m_id3v2_header(nullptr), m_tag(nullptr),
+      m_version(0), m_header_size(0), m_total_size(0),
+      m_projection(nullptr), m_header_unsynch(false), m_next_offset(0),
+      m_tag_offset(0), m_appended_offset(0), m_seek_offset(0)
+{
+}
+
+size_t MyID3V2::ParseDirectSize(const unsigned char *size) {
+    return (size[0] << 16) + (size[1] << 8) + (size[2] << 0);
+}
+
+// size is the 4-byte field of v2.3 and v2.4
+size_t MyID3V2::ParseVerDependSize(const unsigned char *size) const {
     if (m_version < 4) {
-        return ParseDirectSize(size);
+        return ParseDirectSize(&size[1]);
     } else {
-        return ParseSyncSafeSize(size);
+        return MyID3Util::parse_syncsafe(size);
     }
 }
 
+// Bytes added before the body by flags[1] of v2.3/v2.4 frames. In the
+// order of the flags: group ID, encryption method and data length
+// indicator of v2.4, and decompressed size, encryption method and
+// group ID of v2.3.
+size_t MyID3V2::ParseAddedSize(unsigned char flags) const {
+    if (m_version == 4) {
+        return ((flags & (1<<ID3V2_FRAME_FLAG_GROUP_ID_BIT)) ? 1 : 0) +
+            ((flags & (1<<ID3V2_FRAME_FLAG_ENCRYPT_BIT)) ? 1 : 0) +
+            ((flags & (1<<ID3V2_FRAME_FLAG_DATA_LEN_BIT)) ? 4 : 0);
+    }
+    return ((flags & (1<<ID3V23_FRAME_FLAG_COMPRESS_BIT)) ? 4 : 0) +
+        ((flags & (1<<ID3V23_FRAME_FLAG_ENCRYPT_BIT)) ? 1 : 0) +
+        ((flags & (1<<ID3V23_FRAME_FLAG_GROUP_ID_BIT)) ? 1 : 0);
+}
+
 size_t MyID3V2::ParseHeaderSize() {
     // If extended header is valid
-    if (m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_EXT_HEADER_BIT)) {
-        return sizeof(id3v2_header_t) + ParseVerDependSize(&m_id3v2_header->ext_size[1]);
+    if (m_tag != nullptr && m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_EXT_HEADER_BIT)) {
+        return sizeof(id3v2_header_t) + ParseVerDependSize(&m_id3v2_header->ext_size[0]);
     }
     unsigned char *p = nullptr;
     return &((id3v2_header_t*)p)->ext_size[0] - p;
 }
 
 void MyID3V2::AnalyzeSimpleChar(char *out_buf, const char *ptr, size_t size) {
-    char bufwork[size+1];
-    memset (bufwork, 0, sizeof(bufwork));
+    MyArena::Scope scope;
+    char *bufwork = scope.Alloc(size+1);
     memcpy (bufwork, ptr+1, size-1);
+    bufwork[size-1] = '\0';
     MyID3Util::strcpy_maybe_ascii(out_buf, bufwork);
 }
 
 void MyID3V2::AnalyzeStringWithEncode(char *out_buf, const char *ptr, size_t size, unsigned char enc) {
     char charcode[16];
     int retlen = 0;
-    char bufwork[size];
+    // text may not be terminated by '\0' in the frame.
+    MyArena::Scope scope;
+    char *bufwork = scope.Alloc(size+1);
     memcpy (bufwork, ptr, size);
+    bufwork[size] = '\0';
     switch (enc) {
         case 0x00:
             // ISO-8859-1
@@ -290,13 +403,22 @@ void MyID3V2::AnalyzeGEOB(char *out_buf, const char *ptr, size_t size) {
     // Skip to print binary data
 }
 
-bool MyID3V2::AnalyzeHeader(const std::function<void(const print_context_t&)> func) {
-    char print_buf[256];
-    print_context_t context {0, 10, "HEAD", print_buf, m_file->filename.c_str()};
+// Minimum offset to the next tag, from the end of this tag.
+void MyID3V2::AnalyzeSEEK(char *out_buf, const char *ptr, size_t size) {
+    if (size < 4) {
+        strcpy(out_buf, "{BROKEN}");
+        return;
+    }
+    auto p = reinterpret_cast<const unsigned char*>(ptr);
+    sprintf(out_buf, "NextTag(+%zx)",
+            (static_cast<size_t>(p[0]) << 24) + (p[1] << 16) + (p[2] << 8) + p[3]);
+}
 
+// Checks m_id3v2_header, and sets m_version and m_total_size.
+// If it is not a valid header, returns false with the reason in print_buf.
+bool MyID3V2::ParseHeader(char *print_buf) {
     if (memcmp(m_id3v2_header->identify, "ID3", 3) != 0) {
         strcpy(print_buf, "ID3v2 header not found");
-        func(context);
         return false;
     }
 
@@ -311,119 +433,374 @@ bool MyID3V2::AnalyzeHeader(const std::function<void(const print_context_t&)> fu
         } else {
             // NG
             sprintf(print_buf, "invalid header version[%02x%02x]", version_hi, version_lo);
-            func(context);
             return false;
         }
     }
 
-    m_header_size = ParseHeaderSize();
     // need to add header size (but not extended header size)
-    m_total_size = 10 + ParseSyncSafeSize(&m_id3v2_header->size[1]);
+    m_total_size = 10 + MyID3Util::parse_syncsafe(&m_id3v2_header->size[0]);
+    m_header_unsynch = m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_UNSYNC_BIT);
+    return true;
+}
+
+// Fills HEAD of the tag at m_tag_offset into context, and returns false
+// if no frames follow. m_total_size is 0 if the header is not valid.
+bool MyID3V2::AnalyzeHeader(print_context_t& context, char *print_buf) {
+    MyStats::Timer timer(MyStats::STAGE_HEADER);
+    context = {m_tag_offset, 10, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
+    m_tag = nullptr;
+    m_version = 0;
+    m_total_size = 0;
+    m_header_unsynch = false;
+    m_seek_offset = 0;
+
+    m_id3v2_header = reinterpret_cast<const id3v2_header_t*>(m_file->Read(m_tag_offset, 10));
+    if (m_id3v2_header == nullptr) {
+        strcpy(print_buf, "ID3v2 header not found");
+        return false;
+    }
+    if (!ParseHeader(print_buf)) {
+        m_total_size = 0;
+        return false;
+    }
+
+    if (m_total_size < m_file->filesize - m_tag_offset) {
+        m_tag = m_file->Read(m_tag_offset, m_total_size);
+    }
+    if (m_tag != nullptr) {
+        // the extended header is beyond the first 10 bytes read
+        m_id3v2_header = reinterpret_cast<const id3v2_header_t*>(m_tag);
+    }
+    m_header_size = ParseHeaderSize();
     context.size = m_header_size;
-    sprintf(print_buf, "ID3v2.%d TotalTagSize(%zx)", m_version, m_total_size);
-    func(context);
+    int len = sprintf(print_buf, "ID3v2.%d TotalTagSize(%zx)", m_version, m_total_size);
+#if defined(UNSYNCH_DEBUG)
+    if (m_header_unsynch) {
+        sprintf(print_buf + len, " {FLAGS} header flag %02x", m_id3v2_header->flag);
+    }
+#else
+    (void)len;
+#endif
 
-    if (m_header_size >= m_file->filesize || m_total_size >= m_file->filesize) {
+    if (m_tag == nullptr || m_header_size >= m_total_size) {
         return false;
     }
     return true;
 }
 
-void MyID3V2::Analyze(const std::function<void(const print_context_t&)> func) {
-    if (AnalyzeHeader(func) == false) {
-        // no HEAD "ID3" found. Stop analyze
-        return;
+// Where the ID3v2 tag appended at the end of file starts, found by its
+// footer before ID3v1, Lyrics3v2 and APEv2 trailers in any order.
+// Returns 0 if none.
+size_t MyID3V2::FindAppendedTag() const {
+    MyTrailer::trailers_t trailers;
+    MyTrailer::locate(*m_file, &trailers);
+    size_t end = trailers.end;
+
+    auto footer = reinterpret_cast<const unsigned char*>(
+        (end >= ID3V2_FOOTER_SIZE) ? m_file->Read(end - ID3V2_FOOTER_SIZE, ID3V2_FOOTER_SIZE) : nullptr);
+    if (footer == nullptr || memcmp(footer, "3DI", 3) != 0) {
+        return 0;
+    }
+    // same as ParseHeader() calculates the total size
+    size_t total_size = 10 + MyID3Util::parse_syncsafe(&footer[6]);
+    if (end < ID3V2_FOOTER_SIZE + total_size) {
+        return 0;
     }
+    size_t offset = end - ID3V2_FOOTER_SIZE - total_size;
+    const char *header = m_file->Read(offset, 3);
+    if (header == nullptr || memcmp(header, "ID3", 3) != 0) {
+        return 0;
+    }
+    return offset;
+}
 
-    bool header_unsynch = m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_UNSYNC_BIT);
-    char print_buf[ID3V2_TRUNC_BIG_FRAME_SIZE];
-    char buftext[5];
-    memset (buftext, 0, sizeof(buftext));
-    print_context_t context {0, 0, buftext, print_buf, m_file->filename.c_str()};
-#if defined(UNSYNCH_DEBUG)
-    if (header_unsynch) {
-        sprintf(print_buf,"{FLAGS} header flag %02x",m_id3v2_header->flag);
-        func(context);
+// Frames which are inflated to print. Others, like pictures, are only
+// reported to be compressed.
+static bool IsTextFrame(const char *name) {
+    return name[0] == 'T' || name[0] == 'W' || strcmp(name, "COMM") == 0 ||
+        strcmp(name, "USLT") == 0 || strcmp(name, "USER") == 0;
+}
+
+// Inflates zlib data up to out_size into the arena, so that a big frame
+// is never inflated as a whole. Returns the inflated size, 0 if broken.
+static size_t InflatePrefix(const char *src, size_t src_size, char *out, size_t out_size) {
+    MyArena::Scope scope;
+    z_stream zs {};
+    zs.zalloc = [](voidpf opaque, uInt items, uInt size) -> voidpf {
+        return static_cast<MyArena::Scope*>(opaque)->Alloc(static_cast<size_t>(items) * size);
+    };
+    zs.zfree = [](voidpf, voidpf) {
+    };
+    zs.opaque = &scope;
+    if (inflateInit(&zs) != Z_OK) {
+        return 0;
     }
-#endif
-    for (size_t thisoffset = m_header_size; thisoffset < m_total_size; ) {
-        context.offset = thisoffset;
-        size_t header_size = 0;
-        size_t body_size = 0;
-        void(*frame_func)(char*,const char*,size_t) = nullptr;
-        size_t print_buf_len = 0;
-        bool frame_unsynch = false;
-
-        if (m_version == 2) {
-            auto *frame = reinterpret_cast<const id3v2_frame_v2_t*>((const char*)m_file->ptr + context.offset);
-			if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
-                break;
-            }
-            header_size = sizeof(*frame);
-            body_size = ParseVerDependSize(&frame->size[0]);
-            memcpy(buftext, frame->text, sizeof(frame->text));
-            auto elem = frame_entry_tbl_v2.find(buftext);
-            if (elem != frame_entry_tbl_v2.end()) {
-                auto elep = elem->second;
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src));
+    zs.avail_in = src_size;
+    zs.next_out = reinterpret_cast<Bytef*>(out);
+    zs.avail_out = out_size;
+    int ret = inflate(&zs, Z_SYNC_FLUSH);
+    size_t size = zs.total_out;
+    inflateEnd(&zs);
+    return (ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR) ? size : 0;
+}
+
+// Analyzes the frame at offset of the tag, which is frame_ptr. Bytes
+// to be read are the frame header, the data added by the flags (see
+// ParseAddedSize()) and the body after it up to
+// ID3V2_TRUNC_BIG_FRAME_SIZE, or the whole body if unsynchronized.
+// Returns the size to the next frame, or 0 if no more frames (e.g. padding).
+// The frame is filled into context unless skipped by the projection,
+// and *reported tells which.
+size_t MyID3V2::AnalyzeFrame(const char *frame_ptr, size_t offset,
+                             print_context_t& context, id3v2_frame_buf_t& buf, bool *reported) {
+    MyStats::Timer timer(MyStats::STAGE_FRAMES);
+    char *print_buf = buf.text;
+    char *buftext = buf.name;
+    memset (buftext, 0, sizeof(buf.name));
+    context = {offset, 0, buftext, print_buf, m_file->filename.c_str(), 0, 0, false};
+    *reported = false;
+    size_t header_size = 0;
+    size_t body_size = 0;
+    void(*frame_func)(char*,const char*,size_t) = nullptr;
+    size_t print_buf_len = 0;
+    bool frame_unsynch = false;
+    bool frame_compress = false;
+    bool frame_encrypt = false;
+    size_t added_size = 0;      // data added by the flags before the body
+    // unknown frames are printed only without projection
+    bool selected = (m_projection == nullptr);
+
+    if (m_version == 2) {
+        auto *frame = reinterpret_cast<const id3v2_frame_v2_t*>(frame_ptr);
+        if (context.offset + sizeof(*frame) > m_total_size) {
+            return 0;
+        }
+        if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
+            return 0;
+        }
+        header_size = sizeof(*frame);
+        body_size = ParseDirectSize(&frame->size[0]);
+        memcpy(buftext, frame->text, sizeof(frame->text));
+        int elem = frame_hash_v2.Find(PackFrameID(frame->text, sizeof(frame->text)));
+        if (elem >= 0) {
+            selected = (m_projection == nullptr || m_projection->v2.test(elem));
+            auto& elep = frame_entry_tbl_v2[elem];
 # if 0
-                // add summary for tag
-                print_buf_len = sprintf(print_buf, "{%s}", elep.name_desc);
+            // add summary for tag
+            print_buf_len = sprintf(print_buf, "{%s}", elep.name_desc);
 # endif
-                frame_func = elep.func;
-            }
+            frame_func = elep.func;
+        }
+    } else {
+        auto *frame = reinterpret_cast<const id3v2_frame_common_t*>(frame_ptr);
+        if (context.offset + sizeof(*frame) > m_total_size) {
+            return 0;
+        }
+        if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
+            return 0;
+        }
+        header_size = sizeof(*frame);
+        body_size = ParseVerDependSize(&frame->size[0]);
+        frame_unsynch = frame->flags[1] & (1<<ID3V2_FRAME_FLAG_UNSYNCH_BIT);
+        unsigned char flags = frame->flags[1];
+        if (m_version == 4) {
+            frame_compress = flags & (1<<ID3V2_FRAME_FLAG_COMPRESS_BIT);
+            frame_encrypt = flags & (1<<ID3V2_FRAME_FLAG_ENCRYPT_BIT);
         } else {
-            auto *frame = reinterpret_cast<const id3v2_frame_common_t*>((const char*)m_file->ptr + context.offset);
-			if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
-                break;
-            }
-            header_size = sizeof(*frame);
-            body_size = ParseVerDependSize(&frame->size[1]);
-            frame_unsynch = frame->flags[1] & (1<<ID3V2_FRAME_FLAG_UNSYNCH_BIT);
+            frame_compress = flags & (1<<ID3V23_FRAME_FLAG_COMPRESS_BIT);
+            frame_encrypt = flags & (1<<ID3V23_FRAME_FLAG_ENCRYPT_BIT);
+        }
+        added_size = ParseAddedSize(flags);
+        if (added_size > body_size) {
+            added_size = body_size;
+        }
 #if defined(UNSYNCH_DEBUG)
-            if (frame_unsynch) {
-                print_buf_len = sprintf(print_buf, "{FLAGS %02x %02x}",
-                                        frame->flags[0],frame->flags[1]);
-            }
+        if (frame_unsynch) {
+            print_buf_len = sprintf(print_buf, "{FLAGS %02x %02x}",
+                                    frame->flags[0],frame->flags[1]);
+        }
 #endif
-            memcpy(buftext, frame->text, sizeof(frame->text));
-            auto elem = frame_entry_tbl_common.find(buftext);
-            if (elem != frame_entry_tbl_common.end()) {
-                auto elep = elem->second;
+        memcpy(buftext, frame->text, sizeof(frame->text));
+        if (m_version == 4 && memcmp(frame->text, "SEEK", 4) == 0 && !frame_unsynch && !frame_compress &&
+            body_size >= added_size + 4 && context.offset + header_size + added_size + 4 <= m_total_size) {
+            // followed even if the frame is not selected
+            auto p = reinterpret_cast<const unsigned char*>(frame_ptr + header_size + added_size);
+            m_seek_offset = (static_cast<size_t>(p[0]) << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+        }
+        int elem = frame_hash_common.Find(PackFrameID(frame->text, sizeof(frame->text)));
+        if (elem >= 0) {
+            selected = (m_projection == nullptr || m_projection->common.test(elem));
+            auto& elep = frame_entry_tbl_common[elem];
 # if 0
-                // add summary for tag
-                print_buf_len = sprintf(print_buf, "{%s}", elep.name_desc);
+            // add summary for tag
+            print_buf_len = sprintf(print_buf, "{%s}", elep.name_desc);
 #endif
-                frame_func = elep.func;
-            }
+            frame_func = elep.func;
         }
+    }
 
-        // To avoid for parsing big frame, limit size for analyzing.
-        size_t trunc_body_size = body_size;
-        if (trunc_body_size > ID3V2_TRUNC_BIG_FRAME_SIZE) {
-            trunc_body_size = ID3V2_TRUNC_BIG_FRAME_SIZE;
+    if (!selected) {
+        // step over by the header only. Unsynchronized frame still needs
+        // counting of 0xff00 to know where the next frame starts.
+        size_t next_size = header_size + body_size;
+        if (m_header_unsynch || frame_unsynch) {
+            size_t body_offset = context.offset + header_size;
+            size_t body_avail = (body_offset < m_total_size) ? m_total_size - body_offset : 0;
+            next_size += MyUnsync::decode(frame_ptr + header_size, body_avail, body_size, nullptr);
         }
+        return next_size;
+    }
+
+    // Size of compressed data, which is the first of the added data in
+    // v2.3, or the data length indicator at the end of them in v2.4.
+    size_t data_length = 0;
+    if (frame_compress && added_size >= 4 && context.offset + header_size + added_size <= m_total_size) {
+        auto p = reinterpret_cast<const unsigned char*>(frame_ptr + header_size + ((m_version == 4) ? added_size - 4 : 0));
+        data_length = (m_version == 4) ?
+            MyID3Util::parse_syncsafe(p) :
+            (static_cast<size_t>(p[0]) << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+    }
+    header_size += added_size;
+    body_size -= added_size;
+
+    // To avoid for parsing big frame, limit size for analyzing.
+    // Also never read beyond the tag.
+    size_t body_offset = context.offset + header_size;
+    size_t body_avail = (body_offset < m_total_size) ? m_total_size - body_offset : 0;
+    size_t trunc_body_size = body_size;
+    if (trunc_body_size > ID3V2_TRUNC_BIG_FRAME_SIZE) {
+        trunc_body_size = ID3V2_TRUNC_BIG_FRAME_SIZE;
+    }
+    if (trunc_body_size > body_avail) {
+        trunc_body_size = body_avail;
+    }
 
-        // To decode unsynchronized case, prepare temp buf when decode is required.
-        auto body_ptr = reinterpret_cast<const char*>(m_file->ptr) + context.offset + header_size;
-        char decode_buf[trunc_body_size+1];
-        size_t unsynchronized_extended_size = 0;
-        if (header_unsynch || frame_unsynch) {
-            memset (decode_buf, 0, sizeof(decode_buf));
-            unsynchronized_extended_size = DecodeUnsynchronizedBuf(body_ptr, trunc_body_size, decode_buf);
-            body_ptr = decode_buf;
+    // To decode unsynchronized case, prepare temp buf when decode is required.
+    auto body_ptr = frame_ptr + header_size;
+    MyArena::Scope scope;
+    size_t unsynchronized_extended_size = 0;
+    if (m_header_unsynch || frame_unsynch) {
+        char *decode_buf = scope.Alloc(trunc_body_size+1);
+        // Decoding can end short of trunc_body_size only when the input
+        // runs out, as each dropped 0x00 follows a written 0xff.
+        if (body_avail - trunc_body_size < trunc_body_size) {
+            memset (decode_buf, 0, trunc_body_size);
         }
+        decode_buf[trunc_body_size] = '\0';
+        unsynchronized_extended_size = MyUnsync::decode(body_ptr, body_avail, trunc_body_size, decode_buf);
+        body_ptr = decode_buf;
+    }
 
-        if (frame_func != nullptr) {
-            frame_func (&print_buf[print_buf_len], body_ptr, trunc_body_size);
-        } else {
-            strcpy(&print_buf[print_buf_len], "{UNKNOWNFRAME}");
+    context.body_offset = body_offset;
+    context.body_size = body_size + unsynchronized_extended_size;
+    if (context.body_size > body_avail) {
+        context.body_size = body_avail;
+    }
+    context.body_raw = !(m_header_unsynch || frame_unsynch || frame_compress || frame_encrypt);
+    if (frame_compress && !frame_encrypt && frame_func != nullptr && IsTextFrame(buftext) &&
+        trunc_body_size > 0 && m_need_text) {
+        // only as much as printed is inflated
+        char *inflate_buf = scope.Alloc(ID3V2_TRUNC_BIG_FRAME_SIZE+1);
+        trunc_body_size = InflatePrefix(body_ptr, trunc_body_size, inflate_buf, ID3V2_TRUNC_BIG_FRAME_SIZE);
+        inflate_buf[trunc_body_size] = '\0';
+        body_ptr = inflate_buf;
+        if (trunc_body_size == 0) {
+            strcpy(&print_buf[print_buf_len], "{COMPRESSED}{BROKEN}");
+            frame_func = nullptr;
         }
+    } else if (frame_compress || frame_encrypt) {
+        sprintf(&print_buf[print_buf_len], frame_encrypt ? "{ENCRYPTED}" : "{COMPRESSED}(%zx)", data_length);
+        frame_func = nullptr;
+    }
+    if (frame_func == nullptr && (frame_compress || frame_encrypt)) {
+        // already printed
+    } else if (trunc_body_size == 0 || (!m_need_text && context.body_raw)) {
+        print_buf[print_buf_len] = '\0';
+    } else if (frame_func != nullptr) {
+        frame_func (&print_buf[print_buf_len], body_ptr, trunc_body_size);
+    } else {
+        strcpy(&print_buf[print_buf_len], "{UNKNOWNFRAME}");
+    }
 
-        context.size = header_size + body_size + unsynchronized_extended_size;
-        func(context);
+    context.size = header_size + body_size + unsynchronized_extended_size;
+    // offsets in the file
+    context.offset += m_tag_offset;
+    context.body_offset += m_tag_offset;
+    *reported = true;
+    MyStats::CountFrame(buftext);
+    return context.size;
+}
 
-        // going to next loop
-        thisoffset += context.size;
+bool MyID3V2::Start(print_context_t& context, id3v2_frame_buf_t& buf) {
+    m_tag_offset = 0;
+    bool frames = AnalyzeHeader(context, buf.text);
+    m_appended_offset = FindAppendedTag();
+    if (m_total_size == 0 && m_appended_offset != 0) {
+        // no valid tag at the head, the appended one is the first
+        m_tag_offset = m_appended_offset;
+        m_appended_offset = 0;
+        frames = AnalyzeHeader(context, buf.text);
+    } else if (m_appended_offset < m_total_size) {
+        // not after the tag at the head
+        m_appended_offset = 0;
+    }
+    if (!frames) {
+        // no HEAD "ID3" found, or no frames in it
+        m_next_offset = m_total_size;
+        return m_appended_offset != 0;
     }
+    m_next_offset = m_header_size;
+    // a frame takes its decode buffer and the strings made from it
+    size_t frame_size = (m_total_size < ID3V2_TRUNC_BIG_FRAME_SIZE) ? m_total_size : ID3V2_TRUNC_BIG_FRAME_SIZE;
+    MyArena::Get().Reserve(3 * (frame_size + 16));
+    return true;
+}
 
+bool MyID3V2::Next(print_context_t& context, id3v2_frame_buf_t& buf) {
+    while (m_tag != nullptr && m_next_offset < m_total_size) {
+        bool reported;
+        size_t next_size = AnalyzeFrame(m_tag + m_next_offset, m_next_offset, context, buf, &reported);
+        if (next_size == 0) {
+            break;
+        }
+        m_next_offset += next_size;
+        if (reported) {
+            return true;
+        }
+    }
+    m_next_offset = m_total_size;
+    return NextTag(context, buf);
+}
+
+// Moves to the tag after the current one, which SEEK points to, or else
+// the appended one. Tags are only visited forward.
+bool MyID3V2::NextTag(print_context_t& context, id3v2_frame_buf_t& buf) {
+    size_t tag_end = m_tag_offset + m_total_size;
+    if (m_total_size != 0 && m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_FOOTER_BIT)) {
+        tag_end += ID3V2_FOOTER_SIZE;
+    }
+    size_t next = 0;
+    if (m_seek_offset != 0 && m_seek_offset < m_file->filesize && tag_end < m_file->filesize - m_seek_offset) {
+        const char *header = m_file->Read(tag_end + m_seek_offset, 3);
+        if (header != nullptr && memcmp(header, "ID3", 3) == 0) {
+            next = tag_end + m_seek_offset;
+        }
+    }
+    if (next == 0 && m_appended_offset != 0 && m_appended_offset >= tag_end) {
+        next = m_appended_offset;
+    }
+    if (next == 0) {
+        return false;
+    }
+    if (next == m_appended_offset) {
+        m_appended_offset = 0;
+    }
+    m_tag_offset = next;
+    m_next_offset = AnalyzeHeader(context, buf.text) ? m_header_size : m_total_size;
+    return true;
+}
+
+void MyID3V2::Analyze(const std::function<void(const print_context_t&)> func) {
+    AnalyzeWith(func);
 }
@@ -7,7 +7,10 @@
 #define ID3V2_HEADER_FLAG_UNSYNC_BIT (7)
 #define ID3V2_HEADER_FLAG_EXT_HEADER_BIT (6)
 #define ID3V2_HEADER_FLAG_EXPERIMENTAL_BIT (5)
-#define ID3V2_HEADEF_FLAG_FOOTER (4)
+#define ID3V2_HEADER_FLAG_FOOTER_BIT (4)
+
+// ID3v2.4 footer, same as the header but "3DI"
+#define ID3V2_FOOTER_SIZE (10)
 
 typedef struct {
     char identify[3];
@@ -20,12 +23,18 @@ typedef struct {
     unsigned char ext_flags[16];
 } id3v2_header_t;
 
+// flags[1] of v2.4 frames
 #define ID3V2_FRAME_FLAG_GROUP_ID_BIT (6)
 #define ID3V2_FRAME_FLAG_COMPRESS_BIT (3)
 #define ID3V2_FRAME_FLAG_ENCRYPT_BIT  (2)
 #define ID3V2_FRAME_FLAG_UNSYNCH_BIT  (1)
 #define ID3V2_FRAME_FLAG_DATA_LEN_BIT (0)
 
+// flags[1] of v2.3 frames
+#define ID3V23_FRAME_FLAG_COMPRESS_BIT (7)
+#define ID3V23_FRAME_FLAG_ENCRYPT_BIT  (6)
+#define ID3V23_FRAME_FLAG_GROUP_ID_BIT (5)
+
 // for ID3v2 v2.2
 typedef struct {
     char text[3];
@@ -39,28 +48,81 @@ typedef struct {
     unsigned char flags[2];
 } id3v2_frame_common_t;
 
+#define ID3V2_FRAME_TBL_BITS (128)
+
+// Frames to be analyzed, others are skipped without parsing.
+typedef struct {
+    std::bitset<ID3V2_FRAME_TBL_BITS> v2;       // by index of v2.2 frame table
+    std::bitset<ID3V2_FRAME_TBL_BITS> common;   // by index of v2.3/v2.4 frame table
+} id3v2_projection_t;
+
+// Buffers which print_context_t filled by MyID3V2 points to.
+typedef struct {
+    char name[5];
+    char text[ID3V2_TRUNC_BIG_FRAME_SIZE];
+} id3v2_frame_buf_t;
+
 class MyID3V2 : public MyID3Base {
 public:
     MyID3V2(std::shared_ptr<MyFile> file);
 public:
     static std::shared_ptr<MyID3V2> Create(std::shared_ptr<MyFile> file);
     void Analyze(const std::function<void(const print_context_t&)>) override;
+    // Same as Analyze() but statically dispatched, for sink(const print_context_t&)
+    // to be inlined.
+    template<class Sink>
+    void AnalyzeWith(Sink&& sink);
+    // Pull-style analyze, the callback free core of Analyze().
+    // Start() fills HEAD of the first tag, and returns false if nothing follows.
+    bool Start(print_context_t& context, id3v2_frame_buf_t& buf);
+    // Fills the next frame not skipped by the projection, or HEAD of the
+    // next tag, which is pointed by SEEK or appended at the end of file.
+    // Returns false if no more frames.
+    bool Next(print_context_t& context, id3v2_frame_buf_t& buf);
+    // list is comma separated frame IDs, like "TIT2,TPE1".
+    static bool CompileProjection(const char *list, id3v2_projection_t *proj);
+    void SetProjection(const id3v2_projection_t *proj);
     static void AnalyzeSimpleChar(char *out_buf, const char *ptr, size_t size);
     static void AnalyzeStringWithEncode(char *out_buf, const char *ptr, size_t size, unsigned char enc);
     static void AnalyzeString(char *out_buf, const char *ptr, size_t size);
     // for complex parse
     static void AnalyzeUSLT(char *out_buf, const char *ptr, size_t size);
     static void AnalyzeGEOB(char *out_buf, const char *ptr, size_t size);
+    static void AnalyzeSEEK(char *out_buf, const char *ptr, size_t size);
 private:
-    bool AnalyzeHeader(const std::function<void(const print_context_t&)> func);
-    static size_t ParseSyncSafeSize(const unsigned char *size);
+    bool ParseHeader(char *print_buf);
+    bool AnalyzeHeader(print_context_t& context, char *print_buf);
+    size_t FindAppendedTag() const;
+    bool NextTag(print_context_t& context, id3v2_frame_buf_t& buf);
+    size_t AnalyzeFrame(const char *frame_ptr, size_t offset,
+                        print_context_t& context, id3v2_frame_buf_t& buf, bool *reported);
     static size_t ParseDirectSize(const unsigned char *size);
-    size_t DecodeUnsynchronizedBuf(const char *inbuf, size_t size, char *outbuf);
-    size_t ParseVerDependSize(const unsigned char *size);
+    size_t ParseVerDependSize(const unsigned char *size) const;
+    size_t ParseAddedSize(unsigned char flags) const;
     size_t ParseHeaderSize();
-    id3v2_header_t *m_id3v2_header;
+    const id3v2_header_t *m_id3v2_header;
+    const char     *m_tag;
     unsigned char   m_version;
     size_t          m_header_size;
     size_t          m_total_size;
+    const id3v2_projection_t *m_projection;
+    bool            m_header_unsynch;
+    size_t          m_next_offset;
+    size_t          m_tag_offset;       // in the file, frame offsets are from here
+    size_t          m_appended_offset;  // of the tag found by the footer, 0 if none
+    size_t          m_seek_offset;      // by SEEK, from the end of the tag
+    friend class MyID3V2Stream;
 };
 
+template<class Sink>
+void MyID3V2::AnalyzeWith(Sink&& sink) {
+    MyArena::Scope scope;
+    auto& buf = *reinterpret_cast<id3v2_frame_buf_t*>(scope.Alloc(sizeof(id3v2_frame_buf_t)));
+    print_context_t context;
+    bool more = Start(context, buf);
+    sink(static_cast<const print_context_t&>(context));
+    while (more && Next(context, buf)) {
+        sink(static_cast<const print_context_t&>(context));
+    }
+}
+
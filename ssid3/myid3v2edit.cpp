@@ -0,0 +1,472 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <bitset>
+
+#include <iconv.h>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myarena.h"
+#include "myid3v2.h"
+#include "myid3util.h"
+#include "mycharset.h"
+#include "myid3v2edit.h"
+
+// at least this much padding is left when the tag grows
+#define EDIT_PADDING (4096)
+// chunk of copy_file_range(2), or of read(2)/write(2) without it
+#define EDIT_COPY_CHUNK (1024*1024)
+
+static void put_size(unsigned char *p, size_t size, bool syncsafe) {
+    if (syncsafe) {
+        p[0] = (size >> 21) & 0x7f;
+        p[1] = (size >> 14) & 0x7f;
+        p[2] = (size >> 7) & 0x7f;
+        p[3] = size & 0x7f;
+    } else {
+        p[0] = (size >> 24) & 0xff;
+        p[1] = (size >> 16) & 0xff;
+        p[2] = (size >> 8) & 0xff;
+        p[3] = size & 0xff;
+    }
+}
+
+static bool pwrite_full(int fd, const char *buf, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, buf, size, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+bool MyID3V2Edit::ParseEdit(const char *arg, id3v2_edit_t *edit) {
+    const char *eq = strchr(arg, '=');
+    if (eq == nullptr || eq - arg != 4 || !MyID3Util::is_valid_frame_text(arg, 4)) {
+        fprintf(stderr, "invalid edit %s, should be like TIT2=text\n", arg);
+        return false;
+    }
+    edit->id.assign(arg, 4);
+    edit->text.assign(eq + 1);
+    edit->to_utf8 = false;
+    if (!edit->text.empty() && (edit->id[0] != 'T' || edit->id == "TXXX")) {
+        fprintf(stderr, "%s: only text frames can be set\n", edit->id.c_str());
+        return false;
+    }
+    // once here for every version, as v2.4 writes the text as it is
+    if (MyCharset::score(MyCharset::CHARSET_UTF8, edit->text.c_str(), edit->text.size()) == 0) {
+        fprintf(stderr, "%s: text is not UTF-8\n", edit->id.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MyID3V2Edit::ParseRules(const char *path, std::vector<id3v2_edit_t>& edits) {
+    FILE *fp = fopen(path, "r");
+    if (fp == nullptr) {
+        perror(path);
+        return false;
+    }
+    bool ok = true;
+    char line[4096];
+    while (ok && fgets(line, sizeof(line), fp) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        id3v2_edit_t edit;
+        if (strlen(line) == 9 && strcmp(&line[4], " utf8") == 0 &&
+            MyID3Util::is_valid_frame_text(line, 4) && line[0] == 'T' && memcmp(line, "TXXX", 4) != 0) {
+            edit.id.assign(line, 4);
+            edit.to_utf8 = true;
+        } else {
+            ok = ParseEdit(line, &edit);
+        }
+        edits.push_back(edit);
+    }
+    fclose(fp);
+    return ok;
+}
+
+MyID3V2Edit::MyID3V2Edit(const char *filename)
+    : m_filename(filename), m_filesize(0), m_blocksize(4096), m_version(4), m_header_size(0) {
+}
+
+// Reads the current tag and where its frames are.
+bool MyID3V2Edit::ReadTag() {
+    struct stat st;
+    if (stat(m_filename.c_str(), &st) != 0) {
+        perror(m_filename.c_str());
+        return false;
+    }
+    m_filesize = st.st_size;
+    if (st.st_blksize > 0) {
+        m_blocksize = st.st_blksize;
+    }
+
+    auto file = std::make_shared<MyFile>(m_filename.c_str(), MyFile::BACKEND_PREAD);
+    auto header = reinterpret_cast<const unsigned char*>(file->Read(0, 10));
+    if (header == nullptr || memcmp(header, "ID3", 3) != 0) {
+        // a new v2.4 tag is made
+        return true;
+    }
+    if (header[3] != 3 && header[3] != 4) {
+        fprintf(stderr, "%s: ID3v2.%d cannot be edited\n", m_filename.c_str(), header[3]);
+        return false;
+    }
+    if (header[5] & ((1<<ID3V2_HEADER_FLAG_UNSYNC_BIT) | (1<<ID3V2_HEADER_FLAG_EXT_HEADER_BIT) |
+                     (1<<ID3V2_HEADER_FLAG_FOOTER_BIT))) {
+        fprintf(stderr, "%s: tag with unsynchronization, extended header or footer cannot be edited\n",
+                m_filename.c_str());
+        return false;
+    }
+    m_version = header[3];
+    size_t total_size = 10 + MyID3Util::parse_syncsafe(&header[6]);
+    const char *tag = file->Read(0, total_size);
+    if (tag == nullptr || total_size >= m_filesize) {
+        fprintf(stderr, "%s: tag is broken\n", m_filename.c_str());
+        return false;
+    }
+    m_tag.assign(tag, tag + total_size);
+
+    MyID3V2 parser(file);
+    parser.SetNeedText(false);
+    MyArena::Scope scope;
+    auto& buf = *reinterpret_cast<id3v2_frame_buf_t*>(scope.Alloc(sizeof(id3v2_frame_buf_t)));
+    print_context_t context;
+    bool more = parser.Start(context, buf);
+    m_header_size = context.size;
+    while (more && parser.Next(context, buf)) {
+        if (strcmp(context.frame_name, "HEAD") == 0) {
+            // the next tag, not edited
+            break;
+        }
+        m_frames.push_back({context.offset, context.size, context.frame_name});
+    }
+    // The tag is made again from m_frames, so the walk must have reached
+    // the padding. Frames after one it cannot parse would be lost.
+    size_t end = m_frames.empty() ? m_header_size : m_frames.back().offset + m_frames.back().size;
+    for (size_t i = end; i < m_tag.size(); i++) {
+        if (m_tag[i] != '\0') {
+            fprintf(stderr, "%s: frames after %zx cannot be parsed, not edited\n", m_filename.c_str(), end);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Text of the frame in UTF-8, if it should be re-encoded. Any non-ASCII
+// text gets UTF-8 in v2.4, while v2.3 has no UTF-8 and is re-encoded
+// only if the text is not in the charset the frame says, like CP932 in
+// ISO-8859-1.
+bool MyID3V2Edit::ToUTF8(const frame_t& frame, std::string *text) const {
+    static const char *declared[] = {"ISO-8859-1", "UTF-16", "UTF-16BE", "UTF-8"};
+    const char *body = &m_tag[frame.offset + 10];
+    size_t size = frame.size - 10;
+    unsigned char enc = body[0];
+    // compressed, encrypted or unsynchronized frames are kept
+    if (size < 2 || m_tag[frame.offset + 9] != 0 || enc > 3) {
+        return false;
+    }
+    MyArena::Scope scope;
+    size_t src_len = size - 1;
+    char *src = scope.Alloc(src_len + 2);
+    memcpy(src, body + 1, src_len);
+    src[src_len] = src[src_len + 1] = '\0';
+    char charcode[16];
+    if (enc == 2) {
+        strcpy(charcode, declared[enc]);
+    } else if (!MyID3Util::detect_charcode(src, src_len, charcode)) {
+        return false;
+    }
+    if (strcasecmp(charcode, "ASCII") == 0) {
+        return false;
+    }
+    if (strcasecmp(charcode, declared[enc]) == 0 && (m_version == 3 || enc == 3)) {
+        return false;
+    }
+
+    iconv_t ic = MyID3Util::iconv_get("UTF-8", charcode);
+    if (ic == reinterpret_cast<iconv_t>(-1)) {
+        return false;
+    }
+    size_t out_size = 4 * src_len;
+    char *out = scope.Alloc(out_size);
+    char *in_p = src;
+    char *out_p = out;
+    if (iconv(ic, &in_p, &src_len, &out_p, &out_size) == static_cast<size_t>(-1)) {
+        return false;
+    }
+    // terminators are not a part of the text
+    while (out_p > out && out_p[-1] == '\0') {
+        out_p--;
+    }
+    if (out_p == out) {
+        return false;
+    }
+    text->assign(out, out_p - out);
+    return true;
+}
+
+// Text frame in UTF-8 for v2.4. v2.3 has no UTF-8, so ISO-8859-1 for
+// ASCII text, or else UTF-16 with BOM.
+bool MyID3V2Edit::MakeFrame(const id3v2_edit_t& edit, std::string& out) const {
+    std::string body;
+    bool ascii = true;
+    for (unsigned char c : edit.text) {
+        ascii &= (c < 0x80);
+    }
+    if (m_version == 4) {
+        body = '\x03' + edit.text;
+    } else if (ascii) {
+        body = '\x00' + edit.text;
+    } else {
+        iconv_t ic = MyID3Util::iconv_get("UTF-16LE", "UTF-8");
+        if (ic == reinterpret_cast<iconv_t>(-1)) {
+            return false;
+        }
+        std::vector<char> utf16(2 * edit.text.size());
+        char *in_p = const_cast<char*>(edit.text.data());
+        size_t in_len = edit.text.size();
+        char *out_p = utf16.data();
+        size_t out_len = utf16.size();
+        if (iconv(ic, &in_p, &in_len, &out_p, &out_len) == static_cast<size_t>(-1)) {
+            fprintf(stderr, "%s: text is not UTF-8\n", edit.id.c_str());
+            return false;
+        }
+        body = std::string("\x01\xff\xfe", 3) + std::string(utf16.data(), out_p - utf16.data());
+    }
+    unsigned char header[10];
+    memcpy(header, edit.id.data(), 4);
+    put_size(&header[4], body.size(), m_version == 4);
+    header[8] = header[9] = 0;
+    out.append(reinterpret_cast<char*>(header), sizeof(header));
+    out.append(body);
+    return true;
+}
+
+bool MyID3V2Edit::Prepare(const std::vector<id3v2_edit_t>& edits, id3v2_edit_plan_t *plan) {
+    plan->filename = m_filename;
+    plan->filesize = 0;
+    plan->insert = 0;
+    plan->offset = 0;
+    plan->data.clear();
+    if (!ReadTag()) {
+        return false;
+    }
+    plan->filesize = m_filesize;
+    // the last edit of the same ID wins
+    std::vector<id3v2_edit_t> merged;
+    for (auto& edit : edits) {
+        bool found = false;
+        for (auto& elem : merged) {
+            if (elem.id == edit.id) {
+                elem = edit;
+                found = true;
+            }
+        }
+        if (!found) {
+            merged.push_back(edit);
+        }
+    }
+
+    // Edited frames take the place of the first ones of the same ID,
+    // and others of the ID are dropped. New frames are at the end.
+    // Re-encoded frames stay where they are.
+    std::string frames;
+    std::vector<bool> done(merged.size(), false);
+    for (auto& frame : m_frames) {
+        size_t i = 0;
+        for (; i < merged.size() && merged[i].id != frame.id; i++) {
+        }
+        if (i == merged.size()) {
+            frames.append(&m_tag[frame.offset], frame.size);
+            continue;
+        }
+        if (merged[i].to_utf8) {
+            id3v2_edit_t edit {frame.id, std::string(), false};
+            if (!ToUTF8(frame, &edit.text)) {
+                frames.append(&m_tag[frame.offset], frame.size);
+            } else if (!MakeFrame(edit, frames)) {
+                return false;
+            }
+            done[i] = true;
+            continue;
+        }
+        if (!done[i] && !merged[i].text.empty() && !MakeFrame(merged[i], frames)) {
+            return false;
+        }
+        done[i] = true;
+    }
+    for (size_t i = 0; i < merged.size(); i++) {
+        if (!done[i] && !merged[i].to_utf8 && !merged[i].text.empty() && !MakeFrame(merged[i], frames)) {
+            return false;
+        }
+    }
+
+    if (!m_tag.empty() && m_header_size + frames.size() <= m_tag.size()) {
+        PlanInPlace(frames, plan);
+    } else if (!frames.empty()) {
+        PlanGrown(frames, plan);
+    }
+    return true;
+}
+
+// Only the range which differs from the current tag.
+void MyID3V2Edit::PlanInPlace(const std::string& frames, id3v2_edit_plan_t *plan) const {
+    std::string region(frames);
+    region.resize(m_tag.size() - m_header_size, '\0');
+    const char *old = &m_tag[m_header_size];
+    size_t begin = 0;
+    while (begin < region.size() && region[begin] == old[begin]) {
+        begin++;
+    }
+    size_t end = region.size();
+    while (end > begin && region[end-1] == old[end-1]) {
+        end--;
+    }
+    plan->offset = m_header_size + begin;
+    plan->data.assign(region, begin, end - begin);
+}
+
+// The tag grows by whole filesystem blocks, which are inserted at the
+// head, and the new tag is written over them and the current tag.
+void MyID3V2Edit::PlanGrown(const std::string& frames, id3v2_edit_plan_t *plan) const {
+    size_t need = 10 + frames.size() + EDIT_PADDING;
+    size_t grow = (need - m_tag.size() + m_blocksize - 1) / m_blocksize * m_blocksize;
+    size_t total_size = m_tag.size() + grow;
+
+    std::string& tag = plan->data;
+    tag.assign(10, '\0');
+    auto header = reinterpret_cast<unsigned char*>(&tag[0]);
+    memcpy(header, "ID3", 3);
+    header[3] = m_version;
+    header[4] = 0;
+    header[5] = m_tag.empty() ? 0 : m_tag[5];
+    put_size(&header[6], total_size - 10, true);
+    tag += frames;
+    tag.resize(total_size, '\0');
+    plan->insert = grow;
+    plan->offset = 0;
+}
+
+bool MyID3V2Edit::Apply(const std::vector<id3v2_edit_t>& edits) {
+    id3v2_edit_plan_t plan;
+    if (!Prepare(edits, &plan)) {
+        return false;
+    }
+    if (plan.data.empty()) {
+        return true;
+    }
+    int fd = open(m_filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        perror(m_filename.c_str());
+        return false;
+    }
+    bool ok = Write(fd, plan);
+    close(fd);
+    return ok;
+}
+
+bool MyID3V2Edit::Write(int fd, const id3v2_edit_plan_t& plan) {
+    if (plan.insert > 0) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror(plan.filename.c_str());
+            return false;
+        }
+        size_t size = st.st_size;
+        if (size == plan.filesize) {
+            if (size == 0 || fallocate(fd, FALLOC_FL_INSERT_RANGE, 0, plan.insert) != 0) {
+                return WriteByCopy(fd, plan);
+            }
+        } else if (size != plan.filesize + plan.insert) {
+            fprintf(stderr, "%s: file is changed while editing\n", plan.filename.c_str());
+            return false;
+        }
+    }
+    if (!pwrite_full(fd, plan.data.data(), plan.data.size(), plan.offset)) {
+        perror(plan.filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Writes the new tag and the audio after the current tag into a new
+// file, and replaces the file by it. The new file and its directory are
+// synced, for the journal does not know the new file.
+bool MyID3V2Edit::WriteByCopy(int fd, const id3v2_edit_plan_t& plan) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(plan.filename.c_str());
+        return false;
+    }
+    size_t filesize = st.st_size;
+    std::string tmp_path = plan.filename + ".XXXXXX";
+    int out = mkstemp(&tmp_path[0]);
+    if (out < 0) {
+        perror(tmp_path.c_str());
+        return false;
+    }
+    bool ok = pwrite_full(out, plan.data.data(), plan.data.size(), 0);
+    loff_t in_offset = plan.data.size() - plan.insert;
+    loff_t out_offset = plan.data.size();
+    std::vector<char> buf;
+    while (ok && static_cast<size_t>(in_offset) < filesize) {
+        size_t len = filesize - in_offset;
+        len = (len < EDIT_COPY_CHUNK) ? len : EDIT_COPY_CHUNK;
+        ssize_t ret = buf.empty() ? copy_file_range(fd, &in_offset, out, &out_offset, len, 0) : -1;
+        if (ret < 0 && buf.empty() && (errno == ENOSYS || errno == EXDEV || errno == EINVAL)) {
+            // no copy_file_range(2), copy by myself
+            buf.resize(EDIT_COPY_CHUNK);
+        }
+        if (!buf.empty()) {
+            ret = pread(fd, buf.data(), len, in_offset);
+            if (ret > 0 && pwrite_full(out, buf.data(), ret, out_offset)) {
+                in_offset += ret;
+                out_offset += ret;
+            } else {
+                ret = -1;
+            }
+        }
+        ok = (ret > 0);
+    }
+    ok = ok && fchmod(out, st.st_mode & 07777) == 0 && fsync(out) == 0;
+    ok = (close(out) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), plan.filename.c_str()) != 0) {
+        perror(plan.filename.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    SyncDir(plan.filename);
+    return true;
+}
+
+void MyID3V2Edit::SyncDir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _MYID3V2EDIT_H_
+#define _MYID3V2EDIT_H_
+
+typedef struct {
+    std::string id;     // frame ID of v2.3/v2.4, like "TIT2"
+    std::string text;   // in UTF-8, empty to delete the frames
+    bool to_utf8;       // re-encode the current text instead of text
+} id3v2_edit_t;
+
+// Bytes to write for an edit of one file. The tag grows by insert
+// bytes at the head first, if insert > 0, and then data is written at
+// offset. Writing it again after it is done changes nothing, so that
+// it can be replayed from the journal.
+typedef struct {
+    std::string filename;
+    size_t filesize;    // before the edit
+    size_t insert;
+    size_t offset;
+    std::string data;   // empty if nothing changes
+} id3v2_edit_plan_t;
+
+// Edits the ID3v2 tag at the head of the file without rewriting the
+// audio. Frames are found by MyID3V2, and unchanged ones are kept as
+// they are. If the new frames fit in the tag with its padding, only the
+// changed bytes are written. Otherwise the tag grows by whole blocks
+// inserted at the head (FALLOC_FL_INSERT_RANGE), or by a copy of the
+// audio with copy_file_range(2) if the filesystem cannot insert.
+class MyID3V2Edit {
+public:
+    // "TIT2=text"
+    static bool ParseEdit(const char *arg, id3v2_edit_t *edit);
+    // Lines of "TIT2=text", or "TIT2 utf8" to re-encode. '#' comments.
+    static bool ParseRules(const char *path, std::vector<id3v2_edit_t>& edits);
+    explicit MyID3V2Edit(const char *filename);
+    // Returns false with a message if the file cannot be edited.
+    bool Prepare(const std::vector<id3v2_edit_t>& edits, id3v2_edit_plan_t *plan);
+    // Prepare() and Write() without sync.
+    bool Apply(const std::vector<id3v2_edit_t>& edits);
+    // fd is of plan.filename opened for writing. Nothing is synced but
+    // the copy of the audio, which replaces the file.
+    static bool Write(int fd, const id3v2_edit_plan_t& plan);
+    // fsync(2) of the directory of path, for a new or renamed file.
+    static void SyncDir(const std::string& path);
+private:
+    typedef struct {
+        size_t offset;
+        size_t size;
+        std::string id;
+    } frame_t;
+    bool ReadTag();
+    bool ToUTF8(const frame_t& frame, std::string *text) const;
+    bool MakeFrame(const id3v2_edit_t& edit, std::string& out) const;
+    void PlanInPlace(const std::string& frames, id3v2_edit_plan_t *plan) const;
+    void PlanGrown(const std::string& frames, id3v2_edit_plan_t *plan) const;
+    static bool WriteByCopy(int fd, const id3v2_edit_plan_t& plan);
+    std::string m_filename;
+    size_t m_filesize;
+    size_t m_blocksize;
+    std::vector<char> m_tag;        // whole current tag, empty if none
+    unsigned char m_version;
+    size_t m_header_size;           // of the current tag, 0 if none
+    std::vector<frame_t> m_frames;  // in the current tag
+};
+
+#endif /* _MYID3V2EDIT_H_ */
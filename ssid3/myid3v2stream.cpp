@@ -0,0 +1,210 @@
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <bitset>
+
+#include <iconv.h>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myarena.h"
+#include "myid3v2.h"
+#include "myid3v2stream.h"
+#include "myid3util.h"
+#include "myunsync.h"
+
+// MyFile is only for the name, nothing is read through it.
+MyID3V2Stream::MyID3V2Stream(const char *name, const std::function<void(const print_context_t&)> func)
+    : m_parser(std::make_shared<MyFile>(name, 0, std::vector<char>(), std::vector<char>())),
+      m_func(func), m_state(STATE_HEADER), m_base(0), m_pos(0), m_offset(0) {
+}
+
+void MyID3V2Stream::SetProjection(const id3v2_projection_t *proj) {
+    m_parser.SetProjection(proj);
+}
+
+bool MyID3V2Stream::Feed(const char *buf, size_t size) {
+    if (m_state == STATE_DONE) {
+        return false;
+    }
+    if (m_state == STATE_FRAMES) {
+        // drop the rest of the frames already analyzed
+        if (m_pos < m_offset) {
+            size_t skip = (size < m_offset - m_pos) ? size : m_offset - m_pos;
+            buf += skip;
+            size -= skip;
+            m_pos += skip;
+            m_base = m_pos;
+        }
+    }
+    // never keep bytes after the tag
+    if (m_state != STATE_HEADER && m_pos + size > m_parser.m_total_size) {
+        size = (m_pos < m_parser.m_total_size) ? m_parser.m_total_size - m_pos : 0;
+    }
+    m_buf.insert(m_buf.end(), buf, buf + size);
+    m_pos += size;
+    return Step(false);
+}
+
+void MyID3V2Stream::Finish() {
+    if (m_state != STATE_DONE) {
+        Step(true);
+    }
+}
+
+void MyID3V2Stream::ReportHeader(const char *print_buf, size_t size) {
+    print_context_t context {0, size, "HEAD", print_buf, m_parser.m_file->filename.c_str(), 0, 0, false};
+    m_func(context);
+}
+
+// If the frame at m_offset can be analyzed with the bytes in m_buf.
+bool MyID3V2Stream::FrameReady() const {
+    if (m_pos <= m_offset) {
+        return false;
+    }
+    if (m_pos >= m_parser.m_total_size) {
+        return true;
+    }
+    size_t avail = m_pos - m_offset;
+    const char *ptr = m_buf.data() + (m_offset - m_base);
+    size_t header_size;
+    size_t body_size;
+    size_t added_size = 0;
+    bool unsynch = m_parser.m_header_unsynch;
+    if (m_parser.m_version == 2) {
+        auto *frame = reinterpret_cast<const id3v2_frame_v2_t*>(ptr);
+        header_size = sizeof(*frame);
+        if (avail < header_size) {
+            return false;
+        }
+        if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
+            // no more frames, AnalyzeFrame() stops here
+            return true;
+        }
+        body_size = m_parser.ParseDirectSize(&frame->size[0]);
+    } else {
+        auto *frame = reinterpret_cast<const id3v2_frame_common_t*>(ptr);
+        header_size = sizeof(*frame);
+        if (avail < header_size) {
+            return false;
+        }
+        if (!MyID3Util::is_valid_frame_text(frame->text, sizeof(frame->text))) {
+            // no more frames, AnalyzeFrame() stops here
+            return true;
+        }
+        body_size = m_parser.ParseVerDependSize(&frame->size[0]);
+        unsynch |= frame->flags[1] & (1<<ID3V2_FRAME_FLAG_UNSYNCH_BIT);
+        added_size = m_parser.ParseAddedSize(frame->flags[1]);
+        if (added_size > body_size) {
+            added_size = body_size;
+        }
+    }
+    if (!unsynch) {
+        // same as AnalyzeFrame() reads, the added data and the body after it
+        size_t trunc_body_size = body_size - added_size;
+        if (trunc_body_size > ID3V2_TRUNC_BIG_FRAME_SIZE) {
+            trunc_body_size = ID3V2_TRUNC_BIG_FRAME_SIZE;
+        }
+        return header_size + added_size + trunc_body_size <= avail;
+    }
+    // Decoding stops just before the end of input or at body_size, so
+    // a complete frame needs to be followed by some byte.
+    size_t grown = MyUnsync::decode(ptr + header_size, avail - header_size, body_size, nullptr);
+    return header_size + body_size + grown < avail;
+}
+
+bool MyID3V2Stream::Step(bool eof) {
+    char print_buf[256];
+    if (m_state == STATE_HEADER) {
+        if (m_buf.size() < 10) {
+            if (eof) {
+                strcpy(print_buf, "ID3v2 header not found");
+                ReportHeader(print_buf, 10);
+                m_state = STATE_DONE;
+            }
+            return m_state != STATE_DONE;
+        }
+        m_parser.m_id3v2_header = reinterpret_cast<const id3v2_header_t*>(m_buf.data());
+        if (!m_parser.ParseHeader(print_buf)) {
+            ReportHeader(print_buf, 10);
+            m_state = STATE_DONE;
+            return false;
+        }
+        if (m_buf.size() > m_parser.m_total_size) {
+            m_buf.resize(m_parser.m_total_size);
+            m_pos = m_buf.size();
+        }
+        m_state = STATE_EXT_HEADER;
+    }
+
+    if (m_state == STATE_EXT_HEADER) {
+        bool ext = m_parser.m_id3v2_header->flag & (1<<ID3V2_HEADER_FLAG_EXT_HEADER_BIT);
+        size_t need = ext ? offsetof(id3v2_header_t, ext_flag_size) : 10;
+        if (m_parser.m_total_size < need && m_buf.size() >= m_parser.m_total_size) {
+            // broken tiny tag, let the size of the extended header be 0
+            m_buf.resize(need, '\0');
+        }
+        if (m_buf.size() < need && m_buf.size() < m_parser.m_total_size) {
+            if (eof) {
+                // same as a file shorter than the tag
+                m_parser.m_header_size = m_parser.ParseHeaderSize();
+                sprintf(print_buf, "ID3v2.%d TotalTagSize(%zx)", m_parser.m_version, m_parser.m_total_size);
+                ReportHeader(print_buf, m_parser.m_header_size);
+                m_state = STATE_DONE;
+            }
+            return m_state != STATE_DONE;
+        }
+        m_parser.m_tag = m_buf.data();
+        m_parser.m_id3v2_header = reinterpret_cast<const id3v2_header_t*>(m_buf.data());
+        m_parser.m_header_size = m_parser.ParseHeaderSize();
+        // frames are analyzed by AnalyzeFrame() with m_buf, not by these.
+        m_parser.m_tag = nullptr;
+        m_parser.m_id3v2_header = nullptr;
+        sprintf(print_buf, "ID3v2.%d TotalTagSize(%zx)", m_parser.m_version, m_parser.m_total_size);
+        ReportHeader(print_buf, m_parser.m_header_size);
+        if (m_parser.m_header_size >= m_parser.m_total_size) {
+            m_state = STATE_DONE;
+            return false;
+        }
+        m_offset = m_parser.m_header_size;
+        m_state = STATE_FRAMES;
+    }
+
+    MyArena::Scope scope;
+    auto& frame_buf = *reinterpret_cast<id3v2_frame_buf_t*>(scope.Alloc(sizeof(id3v2_frame_buf_t)));
+    while (m_state == STATE_FRAMES) {
+        if (m_offset >= m_parser.m_total_size) {
+            m_state = STATE_DONE;
+            break;
+        }
+        if (!FrameReady()) {
+            if (eof) {
+                // truncated in the middle of the frame
+                m_state = STATE_DONE;
+            }
+            break;
+        }
+        print_context_t context;
+        bool reported;
+        size_t next_size = m_parser.AnalyzeFrame(m_buf.data() + (m_offset - m_base), m_offset,
+                                                 context, frame_buf, &reported);
+        if (next_size == 0) {
+            m_state = STATE_DONE;
+            break;
+        }
+        if (reported) {
+            m_func(context);
+        }
+        m_offset += next_size;
+        // keep only the bytes from the next frame
+        size_t drop = ((m_offset < m_pos) ? m_offset : m_pos) - m_base;
+        m_buf.erase(m_buf.begin(), m_buf.begin() + drop);
+        m_base += drop;
+    }
+    return m_state != STATE_DONE;
+}
@@ -0,0 +1,37 @@
+#ifndef _MYID3V2STREAM_H_
+#define _MYID3V2STREAM_H_
+
+// Push-style ID3v2 parser for pipes and sockets, which need no random
+// access. Chunks of any size are given by Feed(), and each frame is
+// reported as soon as the bytes to analyze it have come. Big frames
+// are not kept in memory beyond ID3V2_TRUNC_BIG_FRAME_SIZE unless they
+// are unsynchronized. Bytes after the tag are not needed.
+class MyID3V2Stream {
+public:
+    MyID3V2Stream(const char *name, const std::function<void(const print_context_t&)> func);
+    void SetProjection(const id3v2_projection_t *proj);
+    // Returns false once no more bytes are needed: the tag has ended,
+    // or the stream does not start with ID3v2.
+    bool Feed(const char *buf, size_t size);
+    // Tells the end of the stream.
+    void Finish();
+private:
+    typedef enum {
+        STATE_HEADER,       // waiting for the 10 bytes header
+        STATE_EXT_HEADER,   // waiting for the size of the extended header
+        STATE_FRAMES,
+        STATE_DONE,         // tag ended, padding is not read
+    } state_t;
+    bool Step(bool eof);
+    bool FrameReady() const;
+    void ReportHeader(const char *print_buf, size_t size);
+    MyID3V2 m_parser;
+    std::function<void(const print_context_t&)> m_func;
+    std::vector<char> m_buf;    // bytes from m_base of the tag
+    state_t m_state;
+    size_t m_base;
+    size_t m_pos;       // of the next byte given by Feed()
+    size_t m_offset;    // of the next frame
+};
+
+#endif /* _MYID3V2STREAM_H_ */
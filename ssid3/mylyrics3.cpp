@@ -0,0 +1,111 @@
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <utility>
+
+#include <iconv.h>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "mylyrics3.h"
+#include "myid3util.h"
+#include "myarena.h"
+#include "mytrailer.h"
+
+#define LYRICS3_BEGIN "LYRICSBEGIN"
+#define LYRICS3_BEGIN_SIZE (11)
+// 6 digits of the size and "LYRICS200"
+#define LYRICS3_END_SIZE (15)
+// 3 letters ID and 5 digits of the size
+#define LYRICS3_FIELD_HEADER_SIZE (8)
+// same as the big frames of ID3v2 are truncated
+#define LYRICS3_TRUNC_FIELD_SIZE (64*1024)
+
+MyLyrics3::MyLyrics3(std::shared_ptr<MyFile> file) : MyID3Base(std::move(file)) {
+}
+
+// https://id3.org/Lyrics3v2
+size_t MyLyrics3::AnalyzeField(const std::function<void(const print_context_t&)> func,
+                               size_t offset, size_t end) {
+    if (end - offset < LYRICS3_FIELD_HEADER_SIZE) {
+        return 0;
+    }
+    const char *header = m_file->Read(offset, LYRICS3_FIELD_HEADER_SIZE);
+    if (header == nullptr || !MyID3Util::is_valid_frame_text(header, 3)) {
+        return 0;
+    }
+    size_t size = 0;
+    for (int i = 3; i < LYRICS3_FIELD_HEADER_SIZE; i++) {
+        if (header[i] < '0' || header[i] > '9') {
+            return 0;
+        }
+        size = size * 10 + (header[i] - '0');
+    }
+    size_t body_offset = offset + LYRICS3_FIELD_HEADER_SIZE;
+    if (size > end - body_offset) {
+        return 0;
+    }
+    char name[4];
+    memcpy(name, header, 3);
+    name[3] = '\0';
+
+    MyArena::Scope scope;
+    size_t trunc_size = (size < LYRICS3_TRUNC_FIELD_SIZE) ? size : LYRICS3_TRUNC_FIELD_SIZE;
+    // ISO-8859-1 grows up to twice in UTF-8
+    char *print_buf = scope.Alloc(2 * trunc_size + 32);
+    print_context_t context {offset, LYRICS3_FIELD_HEADER_SIZE + size, name, print_buf,
+        m_file->filename.c_str(), body_offset, size, true};
+    print_buf[0] = '\0';
+    const char *body = m_need_text ? m_file->Read(body_offset, trunc_size) : nullptr;
+    if (body != nullptr && trunc_size > 0) {
+        char *text = scope.Alloc(trunc_size + 1);
+        memcpy(text, body, trunc_size);
+        text[trunc_size] = '\0';
+        char charcode[16];
+        if (MyID3Util::detect_charcode(text, trunc_size + 1, charcode)) {
+            int retlen = 0;
+            if (charcode[0] != '\0' && strcasecmp(charcode, "ASCII") != 0) {
+                retlen = sprintf(print_buf, "{%s}", charcode);
+            }
+            MyID3Util::strcpy_charcode(&print_buf[retlen], text, trunc_size + 1, charcode);
+        } else {
+            strcpy(print_buf, "{HEXBROKEN}");
+            MyID3Util::strcpy_hex(&print_buf[strlen(print_buf)], text);
+        }
+    }
+    func(context);
+    return context.size;
+}
+
+void MyLyrics3::Analyze(const std::function<void(const print_context_t&)> func) {
+    char print_buf[64];
+    print_context_t context {0, 0, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
+
+    MyTrailer::trailers_t trailers;
+    MyTrailer::locate(*m_file, &trailers);
+    auto trailer = MyTrailer::find(trailers, MyTrailer::TRAILER_LYRICS3V2);
+    const char *begin = (trailer != nullptr) ? m_file->Read(trailer->offset, LYRICS3_BEGIN_SIZE) : nullptr;
+    if (begin == nullptr || trailer->size < LYRICS3_BEGIN_SIZE + LYRICS3_END_SIZE ||
+        memcmp(begin, LYRICS3_BEGIN, LYRICS3_BEGIN_SIZE) != 0) {
+        strcpy(print_buf, "Lyrics3v2 tag not found");
+        func(context);
+        return;
+    }
+    context.offset = trailer->offset;
+    context.size = trailer->size;
+    sprintf(print_buf, "Lyrics3v2 TotalTagSize(%zx)", trailer->size);
+    func(context);
+
+    size_t end = trailer->offset + trailer->size - LYRICS3_END_SIZE;
+    for (size_t offset = trailer->offset + LYRICS3_BEGIN_SIZE; offset < end; ) {
+        size_t field_size = AnalyzeField(func, offset, end);
+        if (field_size == 0) {
+            break;
+        }
+        offset += field_size;
+    }
+}
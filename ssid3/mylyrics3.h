@@ -0,0 +1,16 @@
+#ifndef _MYLYRICS3_H_
+#define _MYLYRICS3_H_
+
+// Lyrics3v2 tag, which is just before ID3v1, found by MyTrailer.
+// Each field is reported with its 3 letters ID, like "LYR".
+class MyLyrics3 : public MyID3Base {
+public:
+    MyLyrics3(std::shared_ptr<MyFile> file);
+    void Analyze(const std::function<void(const print_context_t&)>) override;
+private:
+    // Returns the size of the field at offset, or 0 if it is broken.
+    size_t AnalyzeField(const std::function<void(const print_context_t&)> func,
+                        size_t offset, size_t end);
+};
+
+#endif /* _MYLYRICS3_H_ */
@@ -0,0 +1,271 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <utility>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "mympeg.h"
+#include "mytrailer.h"
+#include "mystats.h"
+
+// the first frame is looked for within this after the ID3v2 tag
+#define MPEG_SEARCH_SIZE (64*1024)
+// frames at this many points over the audio tell if it is CBR
+#define MPEG_SAMPLE_POINTS (8)
+#define MPEG_SAMPLE_WINDOW (4096)
+// Xing/Info is after the side information, VBRI is at a fixed offset
+#define MPEG_VBRI_OFFSET (4 + 32)
+
+static uint32_t ParseBE32(const unsigned char *p) {
+    return (static_cast<uint32_t>(p[0]) << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+// Frames of the same stream keep these, while bitrate may change.
+static bool SameStream(const mpeg_header_t& a, const mpeg_header_t& b) {
+    return a.version == b.version && a.layer == b.layer && a.samplerate == b.samplerate;
+}
+
+MyMPEG::MyMPEG(std::shared_ptr<MyFile> file) : MyID3Base(std::move(file)), m_full_walk(false) {
+}
+
+// http://www.mp3-tech.org/programmer/frame_header.html
+bool MyMPEG::ParseHeader(const unsigned char *p, mpeg_header_t *header) {
+    static const unsigned short bitrates[2][3][15] = {
+        {   // MPEG1, layer 1, 2 and 3
+            {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+            {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+        },
+        {   // MPEG2 and MPEG2.5
+            {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+            {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+        },
+    };
+    static const unsigned int samplerates[3][3] = {
+        {44100, 48000, 32000},  // MPEG1
+        {22050, 24000, 16000},  // MPEG2
+        {11025, 12000, 8000},   // MPEG2.5
+    };
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    unsigned int version = (p[1] >> 3) & 0x03;
+    unsigned int layer = (p[1] >> 1) & 0x03;
+    unsigned int bitrate = (p[2] >> 4) & 0x0f;
+    unsigned int samplerate = (p[2] >> 2) & 0x03;
+    unsigned int padding = (p[2] >> 1) & 0x01;
+    if (version == 0x01 || layer == 0x00 || bitrate == 0x00 || bitrate == 0x0f || samplerate == 0x03) {
+        return false;
+    }
+    bool mpeg1 = (version == 0x03);
+    header->version = mpeg1 ? 10 : (version == 0x02) ? 20 : 25;
+    header->layer = 4 - layer;
+    header->bitrate = bitrates[mpeg1 ? 0 : 1][header->layer - 1][bitrate];
+    header->samplerate = samplerates[mpeg1 ? 0 : (version == 0x02) ? 1 : 2][samplerate];
+    header->channel_mode = p[3] >> 6;
+    switch (header->layer) {
+        case 1:
+            header->samples = 384;
+            header->size = (12000 * header->bitrate / header->samplerate + padding) * 4;
+            break;
+        case 2:
+            header->samples = 1152;
+            header->size = 144000 * header->bitrate / header->samplerate + padding;
+            break;
+        default:
+            header->samples = mpeg1 ? 1152 : 576;
+            header->size = (mpeg1 ? 144000 : 72000) * header->bitrate / header->samplerate + padding;
+            break;
+    }
+    return true;
+}
+
+// The first header followed by another of the same stream, to skip
+// junk which happens to look like a header.
+bool MyMPEG::FindFirst(size_t start, size_t end, mpeg_header_t *header, size_t *offset) const {
+    size_t size = (end - start < MPEG_SEARCH_SIZE) ? end - start : MPEG_SEARCH_SIZE;
+    auto p = reinterpret_cast<const unsigned char*>(m_file->Read(start, size));
+    if (p == nullptr) {
+        return false;
+    }
+    for (size_t i = 0; i + 4 <= size; i++) {
+        if (p[i] != 0xff || !ParseHeader(&p[i], header)) {
+            continue;
+        }
+        mpeg_header_t next;
+        size_t next_offset = i + header->size;
+        if (next_offset + 4 > size || (ParseHeader(&p[next_offset], &next) && SameStream(*header, next))) {
+            *offset = start + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Xing/Info of LAME and others, or VBRI of Fraunhofer, in the first frame.
+bool MyMPEG::ReadInfoHeader(const mpeg_header_t& first, size_t offset, stream_t *stream) const {
+    bool mono = (first.channel_mode == 3);
+    size_t side = (first.version == 10) ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    auto p = reinterpret_cast<const unsigned char*>(m_file->Read(offset, first.size));
+    if (p == nullptr) {
+        return false;
+    }
+    const unsigned char *xing = &p[4 + side];
+    if (4 + side + 16 <= first.size &&
+        (memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0)) {
+        uint32_t flags = ParseBE32(&xing[4]);
+        if (!(flags & 0x01)) {
+            // no number of frames
+            return false;
+        }
+        stream->method = (xing[0] == 'X') ? "XING" : "INFO";
+        stream->vbr = (xing[0] == 'X');
+        stream->frames = ParseBE32(&xing[8]);
+        stream->bytes = (flags & 0x02) ? ParseBE32(&xing[12]) : 0;
+        return true;
+    }
+    const unsigned char *vbri = &p[MPEG_VBRI_OFFSET];
+    if (MPEG_VBRI_OFFSET + 18 <= first.size && memcmp(vbri, "VBRI", 4) == 0) {
+        stream->method = "VBRI";
+        stream->vbr = true;
+        stream->bytes = ParseBE32(&vbri[10]);
+        stream->frames = ParseBE32(&vbri[14]);
+        return true;
+    }
+    return false;
+}
+
+// Returns true if the frames at the sample points have the same bitrate
+// as the first one, which is CBR almost surely.
+bool MyMPEG::Sample(const mpeg_header_t& first, size_t offset, size_t end) const {
+    for (size_t point = 1; point <= MPEG_SAMPLE_POINTS; point++) {
+        size_t pos = offset + (end - offset) / (MPEG_SAMPLE_POINTS + 1) * point;
+        size_t size = (end - pos < MPEG_SAMPLE_WINDOW) ? end - pos : MPEG_SAMPLE_WINDOW;
+        auto p = reinterpret_cast<const unsigned char*>(m_file->Read(pos, size));
+        if (p == nullptr) {
+            return false;
+        }
+        bool found = false;
+        for (size_t i = 0; !found && i + 4 <= size; i++) {
+            mpeg_header_t header;
+            mpeg_header_t next;
+            if (p[i] != 0xff || !ParseHeader(&p[i], &header) || !SameStream(first, header) ||
+                i + header.size + 4 > size) {
+                continue;
+            }
+            found = ParseHeader(&p[i + header.size], &next) && SameStream(first, next);
+            if (found && (header.bitrate != first.bitrate || next.bitrate != first.bitrate)) {
+                return false;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every frame header in order. Bytes which are not a header of the same
+// stream, like junk in the middle, are skipped one by one to sync again.
+void MyMPEG::Walk(const mpeg_header_t& first, size_t offset, size_t end, stream_t *stream) const {
+    unsigned char buf[4];
+    size_t buf_len = 0;
+    size_t skip = 0;
+    *stream = {"WALK", 0, 0, 0, false};
+    m_file->Scan(offset, end - offset, [&](const char *ptr, size_t size) {
+        auto p = reinterpret_cast<const unsigned char*>(ptr);
+        for (size_t i = 0; i < size; ) {
+            if (skip > 0) {
+                size_t n = (skip < size - i) ? skip : size - i;
+                i += n;
+                skip -= n;
+                continue;
+            }
+            buf[buf_len++] = p[i++];
+            if (buf_len < 4) {
+                continue;
+            }
+            mpeg_header_t header;
+            if (!ParseHeader(buf, &header) || !SameStream(first, header)) {
+                memmove(buf, buf + 1, 3);
+                buf_len = 3;
+                continue;
+            }
+            buf_len = 0;
+            stream->frames++;
+            stream->bytes += header.size;
+            stream->samples += header.samples;
+            stream->vbr |= (header.bitrate != first.bitrate);
+            skip = header.size - 4;
+        }
+    });
+    MyStats::Count(MyStats::COUNT_AUDIO_FRAMES, stream->frames);
+}
+
+void MyMPEG::Analyze(const std::function<void(const print_context_t&)> func) {
+    MyStats::Timer timer(MyStats::STAGE_AUDIO);
+    char print_buf[64];
+    print_context_t context {0, 0, "HEAD", print_buf, m_file->filename.c_str(), 0, 0, false};
+
+    size_t start;
+    size_t end;
+    MyTrailer::locate_audio(*m_file, &start, &end);
+    mpeg_header_t first;
+    size_t offset;
+    if (!FindFirst(start, end, &first, &offset)) {
+        context.offset = start;
+        strcpy(print_buf, "MPEG audio not found");
+        func(context);
+        return;
+    }
+    static const char *channel_modes[] = {"Stereo", "Joint stereo", "Dual channel", "Mono"};
+    context.offset = offset;
+    context.size = 4;
+    sprintf(print_buf, "MPEG%u%s Layer%u %uHz %s", first.version / 10, (first.version == 25) ? ".5" : "",
+            first.layer, first.samplerate, channel_modes[first.channel_mode]);
+    func(context);
+
+    // The Xing/Info or VBRI frame is silent, and not counted as audio.
+    stream_t stream {"", 0, 0, 0, false};
+    bool info = ReadInfoHeader(first, offset, &stream);
+    size_t audio = info ? offset + first.size : offset;
+    if (audio > end) {
+        audio = end;
+    }
+    double duration;
+    if (m_full_walk || (!info && !Sample(first, audio, end))) {
+        Walk(first, audio, end, &stream);
+        duration = static_cast<double>(stream.samples) / first.samplerate;
+    } else if (info) {
+        duration = static_cast<double>(stream.frames) * first.samples / first.samplerate;
+    } else {
+        // all frames are as large as the first one, but padding
+        stream = {"CBR", 0, end - audio, 0, false};
+        duration = static_cast<double>(stream.bytes) / (first.bitrate * 125);
+        stream.frames = static_cast<uint64_t>(duration * first.samplerate / first.samples + 0.5);
+    }
+    if (stream.bytes == 0) {
+        stream.bytes = end - audio;
+    }
+    unsigned int bitrate = first.bitrate;
+    if (stream.vbr && duration > 0) {
+        bitrate = static_cast<unsigned int>(stream.bytes / duration / 125 + 0.5);
+    }
+
+    context = {audio, end - audio, "Frames", print_buf, m_file->filename.c_str(), 0, 0, false};
+    sprintf(print_buf, "{%s}%llu", stream.method, static_cast<unsigned long long>(stream.frames));
+    func(context);
+    context.frame_name = "Duration";
+    sprintf(print_buf, "{%s}%.3f", stream.method, duration);
+    func(context);
+    context.frame_name = "Bitrate";
+    sprintf(print_buf, "{%s}%u", stream.vbr ? "VBR" : "CBR", bitrate);
+    func(context);
+}
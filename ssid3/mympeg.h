@@ -0,0 +1,43 @@
+#ifndef _MYMPEG_H_
+#define _MYMPEG_H_
+
+// One MPEG audio frame header.
+typedef struct {
+    unsigned int version;       // 10 for MPEG1, 20 for MPEG2, 25 for MPEG2.5
+    unsigned int layer;
+    unsigned int bitrate;       // kbps
+    unsigned int samplerate;    // Hz
+    unsigned int samples;       // per frame
+    unsigned int channel_mode;  // 3 is mono
+    size_t size;                // of the frame including the header
+} mpeg_header_t;
+
+// Duration and bitrate of the MPEG audio between the ID3v2 tag at the
+// head and the trailing tags. The Xing/Info or VBRI header in the first
+// frame tells them at once. Otherwise some frames sampled over the
+// audio tell if it is CBR, and only VBR audio without those headers
+// needs all the frame headers walked.
+class MyMPEG : public MyID3Base {
+public:
+    MyMPEG(std::shared_ptr<MyFile> file);
+    void Analyze(const std::function<void(const print_context_t&)>) override;
+    // Walks all the frames even if the first frame or samples tell.
+    void SetFullWalk(bool full_walk) { m_full_walk = full_walk; }
+    // Returns false if p is not a valid header, "free" bitrate neither.
+    static bool ParseHeader(const unsigned char *p, mpeg_header_t *header);
+private:
+    typedef struct {
+        const char *method;     // how they are known, like "XING"
+        uint64_t frames;
+        uint64_t bytes;
+        uint64_t samples;
+        bool vbr;
+    } stream_t;
+    bool FindFirst(size_t start, size_t end, mpeg_header_t *header, size_t *offset) const;
+    bool ReadInfoHeader(const mpeg_header_t& first, size_t offset, stream_t *stream) const;
+    bool Sample(const mpeg_header_t& first, size_t offset, size_t end) const;
+    void Walk(const mpeg_header_t& first, size_t offset, size_t end, stream_t *stream) const;
+    bool m_full_walk;
+};
+
+#endif /* _MYMPEG_H_ */
@@ -0,0 +1,69 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "myoutput.h"
+#include "mystats.h"
+
+#define MYOUTPUT_BUF_SIZE (1024*1024)
+
+
+MyOutput::MyOutput(size_t count, int fd)
+    : m_text(count), m_ready(count, false), m_fd(fd) {
+    m_buf.reserve(MYOUTPUT_BUF_SIZE);
+}
+
+void MyOutput::Commit(size_t index, std::string&& text) {
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_text[index] = std::move(text);
+        m_ready[index] = true;
+    }
+    m_cond.notify_one();
+}
+
+void MyOutput::Write(const char *data, size_t size) {
+    MyStats::Timer timer(MyStats::STAGE_OUTPUT);
+    MyStats::Count(MyStats::COUNT_OUTPUT_BYTES, size);
+    while (size > 0) {
+        ssize_t ret = write(m_fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return;
+        }
+        data += ret;
+        size -= ret;
+    }
+}
+
+// Blocks until every index is committed.
+void MyOutput::Flush() {
+    for (size_t i = 0; i < m_text.size(); i++) {
+        std::string text;
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_cond.wait(guard, [&]{ return m_ready[i]; });
+            text.swap(m_text[i]);
+        }
+        if (m_buf.size() + text.size() > MYOUTPUT_BUF_SIZE) {
+            Write(m_buf.data(), m_buf.size());
+            m_buf.clear();
+        }
+        if (text.size() > MYOUTPUT_BUF_SIZE) {
+            Write(text.data(), text.size());
+        } else {
+            m_buf.append(text);
+        }
+    }
+    Write(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
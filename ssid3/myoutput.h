@@ -0,0 +1,21 @@
+#ifndef _MYOUTPUT_H_
+#define _MYOUTPUT_H_
+
+// Collects per file output produced by any thread, and writes them out
+// in the input order through a large buffer.
+class MyOutput {
+public:
+    MyOutput(size_t count, int fd);
+    void Commit(size_t index, std::string&& text);
+    void Flush();
+private:
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::vector<std::string> m_text;
+    std::vector<bool> m_ready;
+    int m_fd;
+    std::string m_buf;
+    void Write(const char *data, size_t size);
+};
+
+#endif /* _MYOUTPUT_H_ */
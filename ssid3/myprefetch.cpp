@@ -0,0 +1,295 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <string>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include "myfile.h"
+#include "myprobe.h"
+#include "myprefetch.h"
+#include "mystats.h"
+
+// same as the probe, which covers the trailing tags
+const size_t MyPrefetch::TAIL_WINDOW = PROBE_TAIL_SIZE;
+
+
+MyPrefetch::MyPrefetch(unsigned int depth)
+    : m_ring_fd(-1), m_sq_entries(0),
+      m_sq_ring(MAP_FAILED), m_sq_ring_size(0),
+      m_cq_ring(MAP_FAILED), m_cq_ring_size(0),
+      m_sqes(MAP_FAILED), m_sqes_size(0),
+      m_sq_head(nullptr), m_sq_tail(nullptr), m_sq_mask(nullptr), m_sq_array(nullptr),
+      m_cq_head(nullptr), m_cq_tail(nullptr), m_cq_mask(nullptr), m_cqes(nullptr)
+{
+    if (!SetupRing(depth) && m_ring_fd >= 0) {
+        close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+}
+
+MyPrefetch::~MyPrefetch() {
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring != MAP_FAILED) {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if (m_ring_fd >= 0) {
+        close(m_ring_fd);
+    }
+}
+
+bool MyPrefetch::SetupRing(unsigned int depth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_ring_fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (m_ring_fd < 0) {
+        return false;
+    }
+    m_sq_entries = p.sq_entries;
+
+    m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (m_cq_ring_size > m_sq_ring_size) {
+            m_sq_ring_size = m_cq_ring_size;
+        }
+        m_cq_ring_size = m_sq_ring_size;
+    }
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED) {
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cq_ring = m_sq_ring;
+    } else {
+        m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED) {
+            return false;
+        }
+    }
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        return false;
+    }
+
+    auto sq = static_cast<char*>(m_sq_ring);
+    m_sq_head = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+    auto cq = static_cast<char*>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+    m_cqes = cq + p.cq_off.cqes;
+
+    // IORING_OP_READ is of Linux 5.6, as is the probe itself.
+    std::vector<char> probe_buf(sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    auto probe = reinterpret_cast<struct io_uring_probe*>(probe_buf.data());
+    if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0 ||
+        probe->last_op < IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+    }
+    return true;
+}
+
+// Takes the completions in the ring. Returns false if waiting failed.
+bool MyPrefetch::Reap(std::vector<request_t>& reqs, unsigned int *inflight, bool wait) {
+    if (wait) {
+        int ret = syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            return false;
+        }
+    }
+    auto cqes = static_cast<struct io_uring_cqe*>(m_cqes);
+    unsigned int head = *m_cq_head;
+    unsigned int cq_tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    while (head != cq_tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *m_cq_mask];
+        auto& req = reqs[cqe->user_data];
+        req.result = cqe->res;
+        req.completed = true;
+        head++;
+        (*inflight)--;
+    }
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+void MyPrefetch::ReadAllUring(std::vector<request_t>& reqs) {
+    auto sqes = static_cast<struct io_uring_sqe*>(m_sqes);
+    size_t next = 0;
+    unsigned int inflight = 0;
+    unsigned int queued = 0;    // in the ring, not yet taken by the kernel
+    bool failed = false;
+    while (next < reqs.size() || queued > 0 || inflight > 0) {
+        // fill the submission queue as much as possible
+        unsigned int tail = *m_sq_tail;
+        while (next < reqs.size() && inflight + queued < m_sq_entries) {
+            unsigned int idx = tail & *m_sq_mask;
+            struct io_uring_sqe *sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = reqs[next].fd;
+            sqe->off = reqs[next].offset;
+            sqe->addr = reinterpret_cast<unsigned long>(reqs[next].buf);
+            sqe->len = reqs[next].size;
+            sqe->user_data = next;
+            m_sq_array[idx] = idx;
+            tail++;
+            next++;
+            queued++;
+        }
+        __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+
+        int ret = syscall(__NR_io_uring_enter, m_ring_fd, queued, 1,
+                          IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("io_uring_enter");
+            failed = true;
+            break;
+        }
+        // the kernel may take only some of them
+        inflight += ret;
+        queued -= ret;
+        Reap(reqs, &inflight, false);
+    }
+    if (!failed) {
+        return;
+    }
+    // The kernel still writes into the buffers of the requests in flight,
+    // so wait for them before they are read again or freed.
+    while (inflight > 0 && Reap(reqs, &inflight, true)) {
+    }
+    // Requests left in the submission queue are dropped with the ring.
+    close(m_ring_fd);
+    m_ring_fd = -1;
+    for (auto& req : reqs) {
+        if (!req.completed) {
+            req.result = pread(req.fd, req.buf, req.size, req.offset);
+            req.completed = true;
+        }
+    }
+}
+
+void MyPrefetch::ReadAll(std::vector<request_t>& reqs) {
+    MyStats::Timer timer(MyStats::STAGE_READ);
+    for (auto& req : reqs) {
+        MyStats::Count(MyStats::COUNT_BYTES_READ, req.size);
+    }
+    if (m_ring_fd >= 0) {
+        ReadAllUring(reqs);
+        return;
+    }
+    for (auto& req : reqs) {
+        req.result = pread(req.fd, req.buf, req.size, req.offset);
+    }
+}
+
+void MyPrefetch::Load(const std::vector<const char*>& names, std::vector<std::shared_ptr<MyFile>>& files,
+                      std::vector<MyProbe::result_t>& probes) {
+    std::vector<int> fds(names.size(), -1);
+    std::vector<size_t> sizes(names.size(), 0);
+    std::vector<std::vector<char>> heads(names.size());
+    std::vector<std::vector<char>> tails(names.size());
+    std::vector<request_t> reqs;
+
+    // first round: probe the ID3v2 header and the tail window
+    for (size_t i = 0; i < names.size(); i++) {
+        int fd = open(names[i], O_RDONLY);
+        if (fd < 0) {
+            perror(names[i]);
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            perror(names[i]);
+            close(fd);
+            continue;
+        }
+        fds[i] = fd;
+        sizes[i] = st.st_size;
+        size_t head_size = (sizes[i] < PROBE_HEAD_SIZE) ? sizes[i] : PROBE_HEAD_SIZE;
+        heads[i].resize(head_size);
+        reqs.push_back({i, fd, 0, head_size, heads[i].data(), 0, false});
+        // tail is only needed when it is not covered by the head.
+        if (sizes[i] > head_size) {
+            size_t tail_size = sizes[i] - head_size;
+            if (tail_size > TAIL_WINDOW) {
+                tail_size = TAIL_WINDOW;
+            }
+            tails[i].resize(tail_size);
+            reqs.push_back({i, fd, sizes[i] - tail_size, tail_size, tails[i].data(), 0, false});
+        }
+    }
+    ReadAll(reqs);
+    for (auto& req : reqs) {
+        if (req.result < 0 || static_cast<size_t>(req.result) != req.size) {
+            // mark as failure
+            heads[req.index].clear();
+        }
+    }
+
+    // second round: the rest of ID3v2 tags, nothing for the others
+    probes.assign(names.size(), {false, false, false, MyProbe::CONTAINER_UNKNOWN, 0});
+    reqs.clear();
+    for (size_t i = 0; i < names.size(); i++) {
+        auto& head = heads[i];
+        if (head.empty()) {
+            continue;
+        }
+        MyProbe::classify(head.data(), head.size(), tails[i].data(), tails[i].size(), &probes[i]);
+        size_t total_size = probes[i].v2_size;
+        if (!probes[i].has_v2 || total_size <= head.size() || total_size >= sizes[i] ||
+            !MyProbe::is_target(probes[i], names[i])) {
+            continue;
+        }
+        size_t head_size = head.size();
+        head.resize(total_size);
+        reqs.push_back({i, fds[i], head_size, total_size - head_size, &head[head_size], 0, false});
+    }
+    ReadAll(reqs);
+    for (auto& req : reqs) {
+        if (req.result < 0 || static_cast<size_t>(req.result) != req.size) {
+            heads[req.index].clear();
+        }
+    }
+
+    files.assign(names.size(), nullptr);
+    for (size_t i = 0; i < names.size(); i++) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        close(fds[i]);
+        if (heads[i].empty()) {
+            if (sizes[i] != 0) {
+                fprintf(stderr, "%s: read failed\n", names[i]);
+            }
+            continue;
+        }
+        files[i] = std::make_shared<MyFile>(names[i], sizes[i], std::move(heads[i]), std::move(tails[i]));
+    }
+}
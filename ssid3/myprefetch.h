@@ -0,0 +1,50 @@
+#ifndef _MYPREFETCH_H_
+#define _MYPREFETCH_H_
+
+// Reads only the head and the tail regions of many files at once with
+// io_uring, and builds MyFile on top of them. Falls back to pread(2)
+// when io_uring is not available.
+// The first round probes the files (see MyProbe), and the second round
+// reads the whole ID3v2 tags of only the targets.
+class MyPrefetch {
+public:
+    static const size_t TAIL_WINDOW;
+    MyPrefetch(unsigned int depth);
+    ~MyPrefetch();
+    // files[i] is nullptr if names[i] cannot be read. Check probes[i]
+    // with MyProbe::is_target() before analyzing files[i].
+    void Load(const std::vector<const char*>& names, std::vector<std::shared_ptr<MyFile>>& files,
+              std::vector<MyProbe::result_t>& probes);
+private:
+    typedef struct {
+        size_t index;
+        int fd;
+        size_t offset;
+        size_t size;
+        char *buf;
+        long result;
+        bool completed;
+    } request_t;
+    bool SetupRing(unsigned int depth);
+    void ReadAll(std::vector<request_t>& reqs);
+    void ReadAllUring(std::vector<request_t>& reqs);
+    bool Reap(std::vector<request_t>& reqs, unsigned int *inflight, bool wait);
+    int m_ring_fd;
+    unsigned int m_sq_entries;
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    void *m_sqes;
+    size_t m_sqes_size;
+    unsigned int *m_sq_head;
+    unsigned int *m_sq_tail;
+    unsigned int *m_sq_mask;
+    unsigned int *m_sq_array;
+    unsigned int *m_cq_head;
+    unsigned int *m_cq_tail;
+    unsigned int *m_cq_mask;
+    void *m_cqes;
+};
+
+#endif /* _MYPREFETCH_H_ */
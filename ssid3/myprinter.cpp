@@ -0,0 +1,234 @@
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include "ssid3.h"
+#include "myprinter.h"
+#include "mystats.h"
+
+
+MyPrinter::MyPrinter(format_t format) : m_format(format) {
+}
+
+bool MyPrinter::ParseFormat(const char *name, format_t *format) {
+    if (strcmp(name, "text") == 0) {
+        *format = FORMAT_SIMPLE;
+    } else if (strcmp(name, "ndjson") == 0) {
+        *format = FORMAT_NDJSON;
+    } else if (strcmp(name, "binary") == 0) {
+        *format = FORMAT_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool MyPrinter::NeedText() const {
+    return m_format != FORMAT_BINARY;
+}
+
+// "%4zx" and "%2zx" without printf
+static void AppendHex(std::string& out, size_t val, int width) {
+    char buf[32];
+    char *p = &buf[sizeof(buf)];
+    do {
+        *--p = "0123456789abcdef"[val & 0xf];
+        val >>= 4;
+    } while (val != 0);
+    for (int len = &buf[sizeof(buf)] - p; len < width; len++) {
+        out.push_back(' ');
+    }
+    out.append(p, &buf[sizeof(buf)] - p);
+}
+
+static void AppendDec(std::string& out, size_t val) {
+    char buf[32];
+    char *p = &buf[sizeof(buf)];
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+    out.append(p, &buf[sizeof(buf)] - p);
+}
+
+// Length of the well-formed UTF-8 sequence at p, or 0 if it is not.
+// Overlong forms, surrogates and values over U+10FFFF are not.
+static size_t Utf8Length(const unsigned char *p) {
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xbf;
+    if (p[0] < 0xc2) {
+        return 0;
+    } else if (p[0] < 0xe0) {
+        len = 2;
+    } else if (p[0] < 0xf0) {
+        len = 3;
+        lo = (p[0] == 0xe0) ? 0xa0 : lo;
+        hi = (p[0] == 0xed) ? 0x9f : hi;
+    } else if (p[0] < 0xf5) {
+        len = 4;
+        lo = (p[0] == 0xf0) ? 0x90 : lo;
+        hi = (p[0] == 0xf4) ? 0x8f : hi;
+    } else {
+        return 0;
+    }
+    // the terminating '\0' fails the check, so p never runs past it
+    if (p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < len; i++) {
+        if (p[i] < 0x80 || p[i] > 0xbf) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// Filenames and APEv2 values may not be UTF-8, each invalid byte
+// becomes U+FFFD so that a line is still valid JSON.
+static void AppendJsonString(std::string& out, const char *str) {
+    out.push_back('"');
+    for (const char *p = str; *p != '\0'; p++) {
+        unsigned char c = *p;
+        if (c >= 0x80) {
+            size_t len = Utf8Length(reinterpret_cast<const unsigned char*>(p));
+            if (len == 0) {
+                out.append("\\ufffd");
+            } else {
+                out.append(p, len);
+                p += len - 1;
+            }
+            continue;
+        }
+        switch (c) {
+            case '"':  out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out.append(buf);
+                } else {
+                    out.push_back(c);
+                }
+                break;
+        }
+    }
+    out.push_back('"');
+}
+
+template<class T>
+static void AppendLE(std::string& out, T val) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        out.push_back(static_cast<char>(static_cast<uint64_t>(val) >> (8 * i)));
+    }
+}
+
+template<class T>
+static void AppendLEString(std::string& out, const char *str) {
+    size_t len = strlen(str);
+    AppendLE<T>(out, len);
+    out.append(str, len);
+}
+
+// typeid(T).name() is like "7MyID3V2"
+static const char *FormatName(const char *name) {
+    while ('0' <= *name && *name <= '9') {
+        name++;
+    }
+    return name;
+}
+
+void MyPrinter::Section(std::string& out, const char *filename, const char *name) const {
+    switch (m_format) {
+        case FORMAT_SIMPLE:
+            out.append(filename);
+            out.append(" ########## ");
+            out.append(name);
+            out.push_back('\n');
+            break;
+        case FORMAT_BINARY: {
+            size_t pos = out.size();
+            AppendLE<uint32_t>(out, 0);
+            AppendLE<uint8_t>(out, 1);
+            AppendLEString<uint16_t>(out, filename);
+            AppendLEString<uint16_t>(out, FormatName(name));
+            uint32_t len = out.size() - pos - 4;
+            for (size_t i = 0; i < 4; i++) {
+                out[pos + i] = static_cast<char>(len >> (8 * i));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void MyPrinter::Frame(std::string& out, const print_context_t& context, const char *name) const {
+    MyStats::Timer timer(MyStats::STAGE_PRINT);
+    switch (m_format) {
+        case FORMAT_VERBOSE:
+            out.append("filename[");
+            out.append(context.filename);
+            out.append("]\t");
+            // fall through
+        case FORMAT_SIMPLE:
+            out.append("offset[");
+            AppendHex(out, context.offset, 4);
+            out.append("]\tsize[");
+            AppendHex(out, context.size, 2);
+            out.append("]\tframe[");
+            out.append(context.frame_name);
+            out.append("]\tbody[");
+            out.append(context.frame_body);
+            out.append("]\n");
+            break;
+        case FORMAT_NDJSON:
+            out.append("{\"file\":");
+            AppendJsonString(out, context.filename);
+            out.append(",\"format\":");
+            AppendJsonString(out, FormatName(name));
+            out.append(",\"offset\":");
+            AppendDec(out, context.offset);
+            out.append(",\"size\":");
+            AppendDec(out, context.size);
+            out.append(",\"frame\":");
+            AppendJsonString(out, context.frame_name);
+            out.append(",\"body\":");
+            AppendJsonString(out, context.frame_body);
+            if (context.body_size != 0) {
+                out.append(",\"body_offset\":");
+                AppendDec(out, context.body_offset);
+                out.append(",\"body_size\":");
+                AppendDec(out, context.body_size);
+            }
+            out.append("}\n");
+            break;
+        case FORMAT_BINARY: {
+            size_t pos = out.size();
+            AppendLE<uint32_t>(out, 0);
+            AppendLE<uint8_t>(out, 2);
+            AppendLE<uint64_t>(out, context.offset);
+            AppendLE<uint64_t>(out, context.size);
+            AppendLEString<uint16_t>(out, context.frame_name);
+            AppendLE<uint64_t>(out, context.body_offset);
+            AppendLE<uint64_t>(out, context.body_size);
+            AppendLE<uint8_t>(out, context.body_raw);
+            AppendLEString<uint32_t>(out, context.frame_body);
+            uint32_t len = out.size() - pos - 4;
+            for (size_t i = 0; i < 4; i++) {
+                out[pos + i] = static_cast<char>(len >> (8 * i));
+            }
+            break;
+        }
+    }
+}
+
+void MyPrinter::SectionEnd(std::string& out) const {
+    if (m_format == FORMAT_SIMPLE) {
+        out.push_back('\n');
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _MYPRINTER_H_
+#define _MYPRINTER_H_
+
+// Formats analyzed records into an output buffer.
+//
+// FORMAT_NDJSON writes one JSON object per record.
+// FORMAT_BINARY writes length prefixed records, all integers are little
+// endian:
+//   u32 length of the rest, u8 type
+//   type 1 (section): u16 len, filename, u16 len, tag format
+//   type 2 (frame):   u64 offset, u64 size, u16 len, frame name,
+//                     u64 body_offset, u64 body_size, u8 body_raw,
+//                     u32 len, body text
+// In binary, body text of a body_raw frame may be empty; read body_size
+// bytes at body_offset of the file instead.
+class MyPrinter {
+public:
+    typedef enum {
+        FORMAT_SIMPLE,
+        FORMAT_VERBOSE,
+        FORMAT_NDJSON,
+        FORMAT_BINARY,
+    } format_t;
+    MyPrinter(format_t format);
+    static bool ParseFormat(const char *name, format_t *format);
+    bool NeedText() const;
+    void Section(std::string& out, const char *filename, const char *name) const;
+    void Frame(std::string& out, const print_context_t& context, const char *name) const;
+    void SectionEnd(std::string& out) const;
+private:
+    format_t m_format;
+};
+
+#endif /* _MYPRINTER_H_ */
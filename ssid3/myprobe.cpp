@@ -0,0 +1,108 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <iconv.h>
+
+#include "myprobe.h"
+#include "myid3util.h"
+#include "mystats.h"
+
+namespace MyProbe {
+
+// 11 bits sync, and no reserved values in version, layer, bitrate and
+// sampling rate.
+static bool is_mpeg_header(const unsigned char *p) {
+    return p[0] == 0xff && (p[1] & 0xe0) == 0xe0 &&
+        ((p[1] >> 3) & 0x03) != 0x01 &&
+        ((p[1] >> 1) & 0x03) != 0x00 &&
+        ((p[2] >> 4) & 0x0f) != 0x0f &&
+        ((p[2] >> 2) & 0x03) != 0x03;
+}
+
+void classify(const char *head, size_t head_size, const char *tail, size_t tail_size, result_t *result) {
+    auto p = reinterpret_cast<const unsigned char*>(head);
+    *result = {false, false, false, CONTAINER_UNKNOWN, 0};
+    if (head_size >= 10 && memcmp(head, "ID3", 3) == 0) {
+        // same as MyID3V2 calculates the total size
+        result->has_v2 = true;
+        result->v2_size = 10 + MyID3Util::parse_syncsafe(&p[6]);
+    } else if (head_size >= 4 && is_mpeg_header(p)) {
+        result->container = CONTAINER_MPEG;
+    } else if (head_size >= 4 && memcmp(head, "fLaC", 4) == 0) {
+        result->container = CONTAINER_FLAC;
+    } else if (head_size >= 8 && memcmp(head + 4, "ftyp", 4) == 0) {
+        result->container = CONTAINER_MP4;
+    }
+    size_t end = tail_size;
+    if (end >= 128 && memcmp(tail + end - 128, "TAG", 3) == 0) {
+        result->has_v1 = true;
+        end -= 128;
+    }
+    // trailers other than ID3v1 are not looked for, see MyID3V2
+    if (end >= 10 && memcmp(tail + end - 10, "3DI", 3) == 0) {
+        result->has_v2_footer = true;
+    }
+}
+
+bool is_target(const result_t& result, const char *filename) {
+    if (result.has_v2 || result.has_v1 || result.has_v2_footer || result.container == CONTAINER_MPEG) {
+        return true;
+    }
+    if (result.container != CONTAINER_UNKNOWN) {
+        // other audio, even if named as .mp3
+        return false;
+    }
+    return strstr(filename, ".mp3") != nullptr;
+}
+
+static bool read_full(int fd, char *buf, size_t size, size_t offset) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t ret = pread(fd, buf + done, size - done, offset + done);
+        if (ret <= 0) {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+bool probe_file(const char *filename, size_t *size,
+                std::vector<char>& head, std::vector<char>& tail, result_t *result) {
+    MyStats::Timer timer(MyStats::STAGE_PROBE);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(filename);
+        close(fd);
+        return false;
+    }
+    *size = st.st_size;
+    size_t head_size = (*size < PROBE_HEAD_SIZE) ? *size : PROBE_HEAD_SIZE;
+    size_t tail_size = (*size - head_size < PROBE_TAIL_SIZE) ? *size - head_size : PROBE_TAIL_SIZE;
+    head.resize(head_size);
+    tail.resize(tail_size);
+    MyStats::Count(MyStats::COUNT_BYTES_READ, head_size + tail_size);
+    bool ok = read_full(fd, head.data(), head_size, 0) &&
+        read_full(fd, tail.data(), tail_size, *size - tail_size);
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "%s: read failed\n", filename);
+        return false;
+    }
+    classify(head.data(), head.size(), tail.data(), tail.size(), result);
+    return true;
+}
+
+} // namespace MyProbe
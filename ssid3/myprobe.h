@@ -0,0 +1,42 @@
+#ifndef _MYPROBE_H_
+#define _MYPROBE_H_
+
+// Classifies a file by its first and last bytes, before reading the
+// tags. Files with neither tags nor an MPEG audio header need no more
+// reads, and the content wins over the extension.
+namespace MyProbe {
+
+// ID3v2 header, also enough for the audio headers below
+#define PROBE_HEAD_SIZE (10)
+// a page, same as the tail window of MyFile, which has ID3v1, the
+// ID3v2.4 footer and usually all the other trailing tags (see MyTrailer)
+#define PROBE_TAIL_SIZE (4096)
+
+typedef enum {
+    CONTAINER_UNKNOWN,
+    CONTAINER_MPEG,     // MPEG audio frame header
+    CONTAINER_FLAC,
+    CONTAINER_MP4,
+} container_t;
+
+typedef struct {
+    bool has_v2;
+    bool has_v1;
+    bool has_v2_footer;     // ID3v2 appended at the end, just before ID3v1 if any
+    container_t container;  // of the head, only if !has_v2
+    size_t v2_size;         // whole ID3v2 tag including the header
+} result_t;
+
+// head is the first head_size bytes, tail is the last tail_size bytes.
+void classify(const char *head, size_t head_size, const char *tail, size_t tail_size, result_t *result);
+// If the file is worth analyzing. The extension decides only when the
+// content is unknown.
+bool is_target(const result_t& result, const char *filename);
+// Reads PROBE_HEAD_SIZE and PROBE_TAIL_SIZE bytes of the file into
+// head and tail. Returns false if the file cannot be read.
+bool probe_file(const char *filename, size_t *size,
+                std::vector<char>& head, std::vector<char>& tail, result_t *result);
+
+} // namespace MyProbe
+
+#endif /* _MYPROBE_H_ */
@@ -0,0 +1,165 @@
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MYSTATS_TSC (1)
+#endif
+
+#include "mystats.h"
+
+
+namespace MyStats {
+
+bool enabled = false;
+
+static const char *stage_names[STAGE_NUM] = {
+    "probe", "open", "read", "header", "frames", "charset", "unsync", "audio", "print", "output",
+};
+
+static const char *counter_names[COUNT_NUM] = {
+    "files", "bytes_mapped", "bytes_read", "frames", "charset_detects", "unsync_decodes", "output_bytes",
+    "audio_frames",
+};
+
+typedef struct {
+    uint64_t ticks[STAGE_NUM];
+    uint64_t calls[STAGE_NUM];
+    uint64_t counts[COUNT_NUM];
+    std::unordered_map<uint32_t, uint64_t> frames;  // by frame ID
+} slot_t;
+
+// Slots are kept after their threads end.
+static std::mutex slots_lock;
+static std::vector<std::unique_ptr<slot_t>> slots;
+static uint64_t start_ticks;
+static uint64_t start_ns;
+
+static uint64_t clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static slot_t& Slot() {
+    thread_local slot_t *slot = nullptr;
+    if (slot == nullptr) {
+        std::lock_guard<std::mutex> guard(slots_lock);
+        slots.emplace_back(new slot_t());
+        slot = slots.back().get();
+    }
+    return *slot;
+}
+
+void Enable() {
+    enabled = true;
+    start_ns = clock_ns();
+    start_ticks = Now();
+}
+
+uint64_t Now() {
+#if defined(MYSTATS_TSC)
+    return __rdtsc();
+#else
+    return clock_ns();
+#endif
+}
+
+void AddTime(stage_t stage, uint64_t ticks) {
+    slot_t& slot = Slot();
+    slot.ticks[stage] += ticks;
+    slot.calls[stage]++;
+}
+
+void AddCount(counter_t counter, uint64_t n) {
+    Slot().counts[counter] += n;
+}
+
+void AddFrame(const char *name) {
+    uint32_t key = 0;
+    memcpy(&key, name, strnlen(name, sizeof(key)));
+    slot_t& slot = Slot();
+    slot.frames[key]++;
+    slot.counts[COUNT_FRAMES]++;
+}
+
+void Dump(bool json) {
+    // TSC rate is measured over the whole run.
+    uint64_t wall_ns = clock_ns() - start_ns;
+    uint64_t wall_ticks = Now() - start_ticks;
+    double ms_per_tick = (wall_ticks > 0) ? wall_ns / 1e6 / wall_ticks : 0;
+
+    slot_t total {};
+    std::map<std::string, uint64_t> frames;
+    for (auto& slot : slots) {
+        for (int i = 0; i < STAGE_NUM; i++) {
+            total.ticks[i] += slot->ticks[i];
+            total.calls[i] += slot->calls[i];
+        }
+        for (int i = 0; i < COUNT_NUM; i++) {
+            total.counts[i] += slot->counts[i];
+        }
+        for (auto& elem : slot->frames) {
+            frames[std::string(reinterpret_cast<const char*>(&elem.first), strnlen(
+                reinterpret_cast<const char*>(&elem.first), sizeof(elem.first)))] += elem.second;
+        }
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double user_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+    double sys_ms = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+
+    if (json) {
+        fprintf(stderr, "{\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"stages\":{",
+                wall_ns / 1e6, user_ms, sys_ms);
+        for (int i = 0; i < STAGE_NUM; i++) {
+            fprintf(stderr, "%s\"%s\":{\"calls\":%llu,\"ms\":%.3f}", (i > 0) ? "," : "", stage_names[i],
+                    static_cast<unsigned long long>(total.calls[i]), total.ticks[i] * ms_per_tick);
+        }
+        fprintf(stderr, "},\"counters\":{");
+        for (int i = 0; i < COUNT_NUM; i++) {
+            fprintf(stderr, "%s\"%s\":%llu", (i > 0) ? "," : "", counter_names[i],
+                    static_cast<unsigned long long>(total.counts[i]));
+        }
+        fprintf(stderr, "},\"rusage\":{\"minflt\":%ld,\"majflt\":%ld,\"maxrss_kb\":%ld},\"frames\":{",
+                ru.ru_minflt, ru.ru_majflt, ru.ru_maxrss);
+        const char *sep = "";
+        for (auto& elem : frames) {
+            fprintf(stderr, "%s\"%s\":%llu", sep, elem.first.c_str(), static_cast<unsigned long long>(elem.second));
+            sep = ",";
+        }
+        fprintf(stderr, "}}\n");
+        return;
+    }
+
+    fprintf(stderr, "wall %.3f ms, user %.3f ms, sys %.3f ms\n", wall_ns / 1e6, user_ms, sys_ms);
+    fprintf(stderr, "%-16s %12s %12s\n", "stage", "calls", "ms");
+    for (int i = 0; i < STAGE_NUM; i++) {
+        fprintf(stderr, "%-16s %12llu %12.3f\n", stage_names[i],
+                static_cast<unsigned long long>(total.calls[i]), total.ticks[i] * ms_per_tick);
+    }
+    fprintf(stderr, "%-16s %12s\n", "counter", "count");
+    for (int i = 0; i < COUNT_NUM; i++) {
+        fprintf(stderr, "%-16s %12llu\n", counter_names[i], static_cast<unsigned long long>(total.counts[i]));
+    }
+    fprintf(stderr, "%-16s %12ld\n", "minflt", ru.ru_minflt);
+    fprintf(stderr, "%-16s %12ld\n", "majflt", ru.ru_majflt);
+    fprintf(stderr, "%-16s %12ld\n", "maxrss_kb", ru.ru_maxrss);
+    fprintf(stderr, "%-16s %12s\n", "frame", "count");
+    for (auto& elem : frames) {
+        fprintf(stderr, "%-16s %12llu\n", elem.first.c_str(), static_cast<unsigned long long>(elem.second));
+    }
+}
+
+} // namespace MyStats
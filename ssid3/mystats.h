@@ -0,0 +1,77 @@
+#ifndef _MYSTATS_H_
+#define _MYSTATS_H_
+
+// Timers and counters of each stage for --stats. Each thread adds into
+// its own slot, and Dump() sums them up at exit. Timers read the TSC.
+// Everything is a single branch while disabled.
+namespace MyStats {
+
+// Stages nest: frames include charset and unsync, and read includes
+// the part of frames which reads the file.
+typedef enum {
+    STAGE_PROBE,        // MyProbe::probe_file()
+    STAGE_OPEN,         // open(2) and mmap(2) of MyFile
+    STAGE_READ,         // pread(2) and io_uring of MyFile and MyPrefetch
+    STAGE_HEADER,       // MyID3V2::AnalyzeHeader()
+    STAGE_FRAMES,       // MyID3V2::AnalyzeFrame()
+    STAGE_CHARSET,      // charset detection and iconv
+    STAGE_UNSYNC,       // MyUnsync decoding
+    STAGE_AUDIO,        // MyMPEG and MyAudioHash, including their reads
+    STAGE_PRINT,        // MyPrinter
+    STAGE_OUTPUT,       // write(2) of the output
+    STAGE_NUM,
+} stage_t;
+
+typedef enum {
+    COUNT_FILES,
+    COUNT_BYTES_MAPPED,
+    COUNT_BYTES_READ,
+    COUNT_FRAMES,
+    COUNT_CHARSET_DETECTS,
+    COUNT_UNSYNC_DECODES,
+    COUNT_OUTPUT_BYTES,
+    COUNT_AUDIO_FRAMES,
+    COUNT_NUM,
+} counter_t;
+
+extern bool enabled;
+
+// Call before any thread starts.
+void Enable();
+uint64_t Now();
+void AddTime(stage_t stage, uint64_t ticks);
+void AddCount(counter_t counter, uint64_t n);
+void AddFrame(const char *name);
+
+inline void Count(counter_t counter, uint64_t n = 1) {
+    if (enabled) {
+        AddCount(counter, n);
+    }
+}
+
+inline void CountFrame(const char *name) {
+    if (enabled) {
+        AddFrame(name);
+    }
+}
+
+class Timer {
+public:
+    explicit Timer(stage_t stage) : m_stage(stage), m_start(enabled ? Now() : 0) {
+    }
+    ~Timer() {
+        if (m_start != 0) {
+            AddTime(m_stage, Now() - m_start);
+        }
+    }
+private:
+    stage_t m_stage;
+    uint64_t m_start;
+};
+
+// Summary table, or JSON, into stderr. Call after all threads end.
+void Dump(bool json);
+
+} // namespace MyStats
+
+#endif /* _MYSTATS_H_ */
@@ -0,0 +1,100 @@
+#include <string>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include <iconv.h>
+
+#include "myfile.h"
+#include "mytrailer.h"
+#include "myid3util.h"
+
+namespace MyTrailer {
+
+static void add(trailers_t *trailers, kind_t kind, size_t offset, size_t size) {
+    trailers->list[trailers->count++] = {kind, offset, size};
+    trailers->end = offset;
+}
+
+void locate(MyFile& file, trailers_t *trailers) {
+    trailers->count = 0;
+    trailers->end = file.filesize;
+    // a round adds up to 4, ID3v1, ID3v1 enhanced, Lyrics3v2 and APEv2
+    for (bool skipped = true; skipped && trailers->count + 4 <= TRAILER_MAX; ) {
+        skipped = false;
+        size_t end = trailers->end;
+        const char *p;
+        if (end >= 128 && (p = file.Read(end - 128, 3)) != nullptr && memcmp(p, "TAG", 3) == 0) {
+            add(trailers, TRAILER_ID3V1, end - 128, 128);
+            end -= 128;
+            skipped = true;
+            // ID3v1 enhanced is just before ID3v1
+            if (end >= 227 && (p = file.Read(end - 227, 4)) != nullptr && memcmp(p, "TAG+", 4) == 0) {
+                add(trailers, TRAILER_ID3V1_ENHANCED, end - 227, 227);
+                end -= 227;
+            }
+        }
+        // 6 digits of the size, excluding these 15 bytes
+        if (end >= 15 && (p = file.Read(end - 15, 15)) != nullptr && memcmp(p + 6, "LYRICS200", 9) == 0) {
+            size_t size = 0;
+            bool valid = true;
+            for (int i = 0; i < 6; i++) {
+                valid &= (p[i] >= '0' && p[i] <= '9');
+                size = size * 10 + (p[i] - '0');
+            }
+            if (valid && end >= 15 + size) {
+                add(trailers, TRAILER_LYRICS3V2, end - 15 - size, 15 + size);
+                end -= 15 + size;
+                skipped = true;
+            }
+        }
+        // footer of 32 bytes, the size includes it but not the header
+        if (end >= 32 && (p = file.Read(end - 32, 32)) != nullptr && memcmp(p, "APETAGEX", 8) == 0) {
+            auto u = reinterpret_cast<const unsigned char*>(p);
+            size_t size = u[12] + (u[13] << 8) + (u[14] << 16) + (static_cast<size_t>(u[15]) << 24);
+            if (u[23] & 0x80) {
+                size += 32;
+            }
+            if (size >= 32 && end >= size) {
+                add(trailers, TRAILER_APEV2, end - size, size);
+                skipped = true;
+            }
+        }
+    }
+}
+
+const trailer_t *find(const trailers_t& trailers, kind_t kind) {
+    for (size_t i = 0; i < trailers.count; i++) {
+        if (trailers.list[i].kind == kind) {
+            return &trailers.list[i];
+        }
+    }
+    return nullptr;
+}
+
+void locate_audio(MyFile& file, size_t *start, size_t *end) {
+    *start = 0;
+    auto head = reinterpret_cast<const unsigned char*>(file.Read(0, 10));
+    if (head != nullptr && memcmp(head, "ID3", 3) == 0) {
+        *start = 10 + MyID3Util::parse_syncsafe(&head[6]);
+        if (head[5] & 0x10) {
+            // footer
+            *start += 10;
+        }
+    }
+    trailers_t trailers;
+    locate(file, &trailers);
+    *end = trailers.end;
+    auto footer = reinterpret_cast<const unsigned char*>(
+        (*end >= 10) ? file.Read(*end - 10, 10) : nullptr);
+    if (footer != nullptr && memcmp(footer, "3DI", 3) == 0) {
+        size_t size = 20 + MyID3Util::parse_syncsafe(&footer[6]);
+        *end = (*end >= size) ? *end - size : 0;
+    }
+    if (*start > *end) {
+        *start = *end;
+    }
+}
+
+} // namespace MyTrailer
@@ -0,0 +1,39 @@
+#ifndef _MYTRAILER_H_
+#define _MYTRAILER_H_
+
+// Tags at the end of the file: ID3v1 (and ID3v1 enhanced before it),
+// Lyrics3v2 and APEv2, in any order. They are found by walking back
+// from the end, all within the tail window which MyFile reads at once.
+namespace MyTrailer {
+
+typedef enum {
+    TRAILER_ID3V1,
+    TRAILER_ID3V1_ENHANCED,
+    TRAILER_LYRICS3V2,
+    TRAILER_APEV2,
+} kind_t;
+
+typedef struct {
+    kind_t kind;
+    size_t offset;
+    size_t size;
+} trailer_t;
+
+#define TRAILER_MAX (8)
+
+typedef struct {
+    trailer_t list[TRAILER_MAX];    // from the end of the file
+    size_t count;
+    size_t end;     // where the trailers start, e.g. the ID3v2.4 footer ends
+} trailers_t;
+
+void locate(MyFile& file, trailers_t *trailers);
+// The last one of kind in the file, or nullptr.
+const trailer_t *find(const trailers_t& trailers, kind_t kind);
+// [start, end) of the audio, after the ID3v2 tag at the head and before
+// the trailers, and the ID3v2 tag appended just before them.
+void locate_audio(MyFile& file, size_t *start, size_t *end);
+
+} // namespace MyTrailer
+
+#endif /* _MYTRAILER_H_ */
@@ -0,0 +1,225 @@
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYUNSYNC_X86 (1)
+#endif
+
+#include "myunsync.h"
+#include "mystats.h"
+
+
+namespace MyUnsync {
+
+typedef struct {
+    size_t in;      // consumed bytes
+    size_t out;     // written bytes
+    bool last_ff;   // previous input byte was 0xff
+} decode_pos_t;
+
+typedef void (*decode_func_t)(const unsigned char *in, size_t insize,
+                              unsigned char *out, size_t outsize, decode_pos_t& pos);
+typedef size_t (*encode_func_t)(const unsigned char *in, size_t insize, unsigned char *out);
+
+static void decode_scalar(const unsigned char *in, size_t insize,
+                          unsigned char *out, size_t outsize, decode_pos_t& pos) {
+    while (pos.out < outsize && pos.in < insize) {
+        unsigned char c = in[pos.in++];
+        if (pos.last_ff && c == 0x00) {
+            pos.last_ff = false;
+            continue;
+        }
+        pos.last_ff = (c == 0xff);
+        if (out != nullptr) {
+            out[pos.out] = c;
+        }
+        pos.out++;
+    }
+}
+
+// 0xff needs 0x00 after it if the next is 0x00, >= 0xe0 or nothing.
+static inline bool need_zero(const unsigned char *in, size_t insize, size_t i) {
+    return in[i] == 0xff && (i+1 == insize || in[i+1] == 0x00 || in[i+1] >= 0xe0);
+}
+
+static size_t encode_bytes(const unsigned char *in, size_t insize, size_t begin, size_t end,
+                           unsigned char *out, size_t p) {
+    for (size_t i = begin; i < end; i++) {
+        if (out != nullptr) {
+            out[p] = in[i];
+        }
+        p++;
+        if (need_zero(in, insize, i)) {
+            if (out != nullptr) {
+                out[p] = 0x00;
+            }
+            p++;
+        }
+    }
+    return p;
+}
+
+static size_t encode_scalar(const unsigned char *in, size_t insize, unsigned char *out) {
+    return encode_bytes(in, insize, 0, insize, out, 0);
+}
+
+// Blocks of W bytes are stored as is if nothing is dropped. "drop" has
+// bit j set for in[j] == 0x00 after 0xff. A block is taken only if it
+// cannot reach outsize, so that stopping point is same as the scalar.
+#define DECODE_BLOCK(W, ff_bits, zero_bits, store)                          \
+    do {                                                                    \
+        uint32_t drop = (zero_bits) & (((ff_bits) << 1) | (pos.last_ff ? 1 : 0)); \
+        if (drop == 0) {                                                    \
+            if (out != nullptr) {                                           \
+                store;                                                      \
+            }                                                               \
+            pos.out += (W);                                                 \
+        } else {                                                            \
+            for (size_t j = 0; j < (W); j++) {                              \
+                if (!((drop >> j) & 1)) {                                   \
+                    if (out != nullptr) {                                   \
+                        out[pos.out] = in[pos.in + j];                      \
+                    }                                                       \
+                    pos.out++;                                              \
+                }                                                           \
+            }                                                               \
+        }                                                                   \
+        pos.last_ff = ((ff_bits) >> ((W)-1)) & 1;                           \
+        pos.in += (W);                                                      \
+    } while (0)
+
+#if defined(MYUNSYNC_X86)
+static void decode_sse2(const unsigned char *in, size_t insize,
+                        unsigned char *out, size_t outsize, decode_pos_t& pos) {
+    const __m128i ff = _mm_set1_epi8(static_cast<char>(0xff));
+    const __m128i zero = _mm_setzero_si128();
+    while (pos.in + 16 <= insize && pos.out + 16 < outsize) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos.in));
+        uint32_t ff_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(x, ff));
+        uint32_t zero_bits = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+        DECODE_BLOCK(16, ff_bits, zero_bits,
+                     _mm_storeu_si128(reinterpret_cast<__m128i*>(out + pos.out), x));
+    }
+    decode_scalar(in, insize, out, outsize, pos);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(const unsigned char *in, size_t insize,
+                        unsigned char *out, size_t outsize, decode_pos_t& pos) {
+    const __m256i ff = _mm256_set1_epi8(static_cast<char>(0xff));
+    const __m256i zero = _mm256_setzero_si256();
+    while (pos.in + 32 <= insize && pos.out + 32 < outsize) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + pos.in));
+        uint32_t ff_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, ff));
+        uint32_t zero_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero));
+        DECODE_BLOCK(32, ff_bits, zero_bits,
+                     _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + pos.out), x));
+    }
+    decode_sse2(in, insize, out, outsize, pos);
+}
+
+// Blocks without 0xff are copied as is.
+static size_t encode_sse2(const unsigned char *in, size_t insize, unsigned char *out) {
+    const __m128i ff = _mm_set1_epi8(static_cast<char>(0xff));
+    size_t i = 0;
+    size_t p = 0;
+    for (; i + 16 <= insize; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, ff)) == 0) {
+            if (out != nullptr) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + p), x);
+            }
+            p += 16;
+        } else {
+            p = encode_bytes(in, insize, i, i + 16, out, p);
+        }
+    }
+    return encode_bytes(in, insize, i, insize, out, p);
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(const unsigned char *in, size_t insize, unsigned char *out) {
+    const __m256i ff = _mm256_set1_epi8(static_cast<char>(0xff));
+    size_t i = 0;
+    size_t p = 0;
+    for (; i + 32 <= insize; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, ff)) == 0) {
+            if (out != nullptr) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + p), x);
+            }
+            p += 32;
+        } else {
+            p = encode_bytes(in, insize, i, i + 32, out, p);
+        }
+    }
+    return encode_bytes(in, insize, i, insize, out, p);
+}
+#endif
+
+static decode_func_t select_decode() {
+#if defined(MYUNSYNC_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return decode_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return decode_sse2;
+    }
+#endif
+    return decode_scalar;
+}
+
+static encode_func_t select_encode() {
+#if defined(MYUNSYNC_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return encode_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return encode_sse2;
+    }
+#endif
+    return encode_scalar;
+}
+
+static const decode_func_t decode_run = select_decode();
+static const encode_func_t encode_run = select_encode();
+
+
+size_t decode(const char *in, size_t insize, size_t size, char *out) {
+    if (insize == 0) {
+        return 0;
+    }
+    if (size == 0) {
+        // first byte should always be copied.
+        if (out != nullptr) {
+            out[0] = in[0];
+        }
+        return 1;
+    }
+    MyStats::Timer timer(MyStats::STAGE_UNSYNC);
+    MyStats::Count(MyStats::COUNT_UNSYNC_DECODES);
+    decode_pos_t pos {0, 0, false};
+    decode_run(reinterpret_cast<const unsigned char*>(in), insize,
+               reinterpret_cast<unsigned char*>(out), size, pos);
+    return pos.in - size;
+}
+
+size_t encode(const char *in, size_t insize, char *out) {
+    return encode_run(reinterpret_cast<const unsigned char*>(in), insize,
+                      reinterpret_cast<unsigned char*>(out));
+}
+
+size_t Decoder::Feed(const char *in, size_t insize, char *out) {
+    MyStats::Timer timer(MyStats::STAGE_UNSYNC);
+    MyStats::Count(MyStats::COUNT_UNSYNC_DECODES);
+    decode_pos_t pos {0, 0, m_last_ff};
+    decode_run(reinterpret_cast<const unsigned char*>(in), insize,
+               reinterpret_cast<unsigned char*>(out), SIZE_MAX, pos);
+    m_last_ff = pos.last_ff;
+    return pos.out;
+}
+
+} // namespace MyUnsync
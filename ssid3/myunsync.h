@@ -0,0 +1,31 @@
+#ifndef _MYUNSYNC_H_
+#define _MYUNSYNC_H_
+
+// ID3v2 unsynchronization, "0xff 0x00" <-> "0xff".
+// Runs without 0xff are handled in SSE2/AVX2 blocks when the CPU has them.
+namespace MyUnsync {
+
+// Decodes in until size bytes are written or in is exhausted. The first
+// byte is always taken. Returns consumed bytes minus size, i.e. how much
+// the frame grew by unsynchronization.
+// out can be nullptr only to count, or can be in itself.
+size_t decode(const char *in, size_t insize, size_t size, char *out);
+
+// Encodes whole in. out needs 2*insize bytes at most, or nullptr to count.
+// Returns written bytes.
+size_t encode(const char *in, size_t insize, char *out);
+
+// Decodes a stream given in chunks, "0xff" at the end of a chunk is
+// remembered for the next one.
+class Decoder {
+public:
+    Decoder() : m_last_ff(false) {}
+    // out can be in itself. Returns written bytes, at most insize.
+    size_t Feed(const char *in, size_t insize, char *out);
+private:
+    bool m_last_ff;
+};
+
+} // namespace MyUnsync
+
+#endif /* _MYUNSYNC_H_ */
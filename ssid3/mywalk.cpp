@@ -0,0 +1,104 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "mywalk.h"
+
+
+namespace MyWalk {
+
+// glibc has no wrapper for getdents64 before 2.30, so define it here.
+struct linux_dirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+static bool WalkFd(int fd, const std::string& path, std::vector<std::string>& out) {
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+    // keep the buffer off the stack, as this function recurses.
+    std::vector<char> buf(64*1024);
+    while (1) {
+        long nread = syscall(SYS_getdents64, fd, buf.data(), buf.size());
+        if (nread < 0) {
+            perror(path.c_str());
+            return false;
+        }
+        if (nread == 0) {
+            break;
+        }
+        for (long pos = 0; pos < nread; ) {
+            auto *d = reinterpret_cast<linux_dirent64*>(buf.data() + pos);
+            pos += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN) {
+                // some filesystems do not fill d_type.
+                struct stat st;
+                if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)) {
+                    type = DT_DIR;
+                } else if (S_ISREG(st.st_mode)) {
+                    type = DT_REG;
+                }
+            }
+            if (type == DT_DIR) {
+                dirs.push_back(d->d_name);
+            } else if (type == DT_REG) {
+                files.push_back(d->d_name);
+            }
+        }
+    }
+
+    buf.clear();
+    buf.shrink_to_fit();
+
+    std::sort(files.begin(), files.end());
+    for (auto& elem : files) {
+        out.push_back(path + "/" + elem);
+    }
+    std::sort(dirs.begin(), dirs.end());
+    for (auto& elem : dirs) {
+        int subfd = openat(fd, elem.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (subfd < 0) {
+            perror((path + "/" + elem).c_str());
+            continue;
+        }
+        WalkFd(subfd, path + "/" + elem, out);
+        close(subfd);
+    }
+    return true;
+}
+
+bool Walk(const char *dir, std::vector<std::string>& out) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror(dir);
+        return false;
+    }
+    std::string path(dir);
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    bool retval = WalkFd(fd, path, out);
+    close(fd);
+    return retval;
+}
+
+} // namespace MyWalk
@@ -0,0 +1,12 @@
+#ifndef _MYWALK_H_
+#define _MYWALK_H_
+
+namespace MyWalk {
+
+// Append every regular file under dir to out, walking the tree with
+// getdents64(2). Entries of each directory are sorted by name.
+bool Walk(const char *dir, std::vector<std::string>& out);
+
+} // namespace MyWalk
+
+#endif /* _MYWALK_H_ */
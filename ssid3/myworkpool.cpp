@@ -0,0 +1,78 @@
+#include <memory>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "myworkpool.h"
+
+
+MyWorkPool::MyWorkPool(unsigned int workers) {
+    if (workers == 0) {
+        workers = 1;
+    }
+    for (unsigned int i = 0; i < workers; i++) {
+        m_queues.emplace_back(new Queue);
+    }
+}
+
+MyWorkPool::~MyWorkPool() {
+    Wait();
+}
+
+unsigned int MyWorkPool::DefaultWorkers() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n == 0) ? 1 : n;
+}
+
+void MyWorkPool::Start(size_t count, const std::function<void(size_t)> func) {
+    m_func = func;
+    // Deal tasks round robin, so that the head of the input is processed
+    // first by every worker and ordered output can be flushed early.
+    for (size_t i = 0; i < count; i++) {
+        m_queues[i % m_queues.size()]->tasks.push_back(i);
+    }
+    for (unsigned int i = 0; i < m_queues.size(); i++) {
+        m_threads.emplace_back(&MyWorkPool::Worker, this, i);
+    }
+}
+
+void MyWorkPool::Wait() {
+    for (auto& th : m_threads) {
+        th.join();
+    }
+    m_threads.clear();
+}
+
+bool MyWorkPool::PopOwn(unsigned int id, size_t *task) {
+    Queue& q = *m_queues[id];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty()) {
+        return false;
+    }
+    *task = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+}
+
+bool MyWorkPool::Steal(unsigned int id, size_t *task) {
+    for (size_t i = 1; i < m_queues.size(); i++) {
+        Queue& q = *m_queues[(id + i) % m_queues.size()];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (!q.tasks.empty()) {
+            *task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void MyWorkPool::Worker(unsigned int id) {
+    size_t task;
+    // No task is added after Start(), so all queues empty means finished.
+    while (PopOwn(id, &task) || Steal(id, &task)) {
+        m_func(task);
+    }
+}
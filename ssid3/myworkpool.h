@@ -0,0 +1,26 @@
+#ifndef _MYWORKPOOL_H_
+#define _MYWORKPOOL_H_
+
+// Fixed size thread pool. Each worker owns a deque of task indices and
+// takes from its front; an idle worker steals from the back of the others.
+class MyWorkPool {
+public:
+    MyWorkPool(unsigned int workers);
+    ~MyWorkPool();
+    void Start(size_t count, const std::function<void(size_t)> func);
+    void Wait();
+    static unsigned int DefaultWorkers();
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    void Worker(unsigned int id);
+    bool PopOwn(unsigned int id, size_t *task);
+    bool Steal(unsigned int id, size_t *task);
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::function<void(size_t)> m_func;
+};
+
+#endif /* _MYWORKPOOL_H_ */
@@ -1,73 +1,546 @@
+#include <unistd.h>
+#include <errno.h>
+
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <functional>
 #include <typeinfo>
+#include <vector>
+#include <bitset>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "ssid3.h"
 #include "myfile.h"
 #include "myid3base.h"
 #include "myid3v1.h"
+#include "myape.h"
+#include "mylyrics3.h"
+#include "mympeg.h"
+#include "myaudiohash.h"
+#include "myarena.h"
 #include "myid3v2.h"
+#include "myid3v2stream.h"
+#include "myworkpool.h"
+#include "myoutput.h"
+#include "mywalk.h"
+#include "myprobe.h"
+#include "myprefetch.h"
+#include "mycache.h"
+#include "myprinter.h"
+#include "myextract.h"
+#include "myid3v2edit.h"
+#include "myeditjournal.h"
+#include "mystats.h"
+
+static unsigned int job_count = 0;
+static bool prefetch_mode = false;
+static MyFile::backend_t file_backend = MyFile::BACKEND_PREAD;
+static MyScanCache *scan_cache = nullptr;
+static const MyPrinter *printer = nullptr;
+static std::string projection_list;
+static id3v2_projection_t projection;
+static bool extract_mode = false;
+static bool trailer_mode = false;
+static bool audio_mode = false;
+static bool audio_full_walk = false;
+static bool audio_hash_mode = false;
+static std::string extract_dir;
+static std::vector<id3v2_edit_t> edits;
 
-static bool verbose_mode = false;
+// files handled by one task in prefetch mode
+#define PREFETCH_BATCH (32)
 
-static void SimplePrinter(const print_context_t& context) {
-    printf("offset[%4zx]\tsize[%2zx]\tframe[%s]\tbody[%s]\n",
-           context.offset, context.size,
-           context.frame_name, context.frame_body);
+template<class T>
+static void SetupAnalysis(T*) {
+}
+static void SetupAnalysis(MyID3V2 *ptr) {
+    if (!projection_list.empty()) {
+        ptr->SetProjection(&projection);
+    }
+}
+static void SetupAnalysis(MyMPEG *ptr) {
+    ptr->SetFullWalk(audio_full_walk);
 }
 
-static void VerbosePrinter(const print_context_t& context) {
-    printf("filename[%s]\toffset[%4zx]\tsize[%2zx]\tframe[%s]\tbody[%s]\n",
-           context.filename,
-           context.offset, context.size,
-           context.frame_name, context.frame_body);
+// With -x, the text of APIC/GEOB gets where the payload is and its hash,
+// and the payload is stored into extract_dir with -X. Returns the
+// context to print, which is extracted if it is changed.
+static const print_context_t& ExtractObject(MyFile& file, const print_context_t& context,
+                                            print_context_t& extracted, std::string& text) {
+    MyExtract::object_t object;
+    if (!extract_mode || !MyExtract::is_object_frame(context.frame_name) ||
+        !MyExtract::locate(file, context, &object)) {
+        return context;
+    }
+    if (!extract_dir.empty()) {
+        MyExtract::store(file, object, extract_dir.c_str());
+    }
+    text.assign(context.frame_body);
+    text += "<>";
+    MyExtract::format(object, text);
+    extracted = context;
+    extracted.frame_body = text.c_str();
+    return extracted;
 }
 
+// The analyzer is on the stack and T::AnalyzeWith() is resolved at
+// compile time, so that printing is inlined into the frame loop.
 template<class T>
-static void MyAnalysis(std::shared_ptr<MyFile> file) {
-    auto ptr = MyID3Base::Create<T>(file);
-    if (ptr == nullptr) {
+static void MyAnalysis(const std::shared_ptr<MyFile>& file, std::string& out,
+                       std::vector<cache_record_t> *records) {
+    T analyzer(file);
+
+    const char *name = typeid(T).name();
+    printer->Section(out, file->filename.c_str(), name);
+    if (records != nullptr) {
+        records->push_back({true, 0, 0, name, "", 0, 0, false});
+    }
+    analyzer.SetNeedText(printer->NeedText());
+    SetupAnalysis(&analyzer);
+    print_context_t extracted;
+    std::string text;
+    analyzer.AnalyzeWith([&](const print_context_t& frame_context) {
+        const print_context_t& context = ExtractObject(*file, frame_context, extracted, text);
+        printer->Frame(out, context, name);
+        if (records != nullptr) {
+            records->push_back({false, context.offset, context.size,
+                                context.frame_name, context.frame_body,
+                                context.body_offset, context.body_size, context.body_raw});
+        }
+    });
+    printer->SectionEnd(out);
+}
+
+static bool PrintCached(const char *filename, const cache_key_t& key, std::string& out) {
+    std::vector<cache_record_t> records;
+    if (!scan_cache->Lookup(key, records)) {
+        return false;
+    }
+    const char *name = nullptr;
+    for (auto& elem : records) {
+        if (elem.section) {
+            if (name != nullptr) {
+                printer->SectionEnd(out);
+            }
+            name = elem.frame_name.c_str();
+            printer->Section(out, filename, name);
+        } else {
+            print_context_t context {elem.offset, elem.size,
+                elem.frame_name.c_str(), elem.frame_body.c_str(), filename,
+                elem.body_offset, elem.body_size, elem.body_raw};
+            printer->Frame(out, context, (name != nullptr) ? name : "");
+        }
+    }
+    if (name != nullptr) {
+        printer->SectionEnd(out);
+    }
+    return true;
+}
+
+
+
+// "-" reads the tag from stdin, which can be a pipe. Only ID3v2 is
+// analyzed, and reading stops at the end of the tag. So tags appended
+// at the end are not found, and -x is not done.
+static void do_stream(int fd, const char *name, std::string& out) {
+    const char *format_name = typeid(MyID3V2).name();
+    printer->Section(out, name, format_name);
+    // body text is always needed, as bodies cannot be read again later.
+    MyID3V2Stream stream(name, [&out, format_name](const print_context_t& context) {
+        printer->Frame(out, context, format_name);
+    });
+    if (!projection_list.empty()) {
+        stream.SetProjection(&projection);
+    }
+    std::vector<char> buf(64*1024);
+    while (1) {
+        ssize_t len = read(fd, buf.data(), buf.size());
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            if (len < 0) {
+                perror(name);
+            }
+            stream.Finish();
+            break;
+        }
+        if (!stream.Feed(buf.data(), len)) {
+            break;
+        }
+    }
+    printer->SectionEnd(out);
+}
+
+// key is nullptr if the result should not be cached. file is nullptr
+// if the probe tells it is not a target, which is cached as no records.
+static void do_file(const std::shared_ptr<MyFile>& file, const char *filename, std::string& out,
+                    const cache_key_t *key) {
+    if (file != nullptr && !file->Ready()) {
         return;
     }
+    std::vector<cache_record_t> records;
+    if (file != nullptr) {
+        auto records_ptr = (key != nullptr) ? &records : nullptr;
+        MyAnalysis<MyID3V2>(file, out, records_ptr);
+        if (audio_mode) {
+            // through the same MyFile as the tags
+            MyAnalysis<MyMPEG>(file, out, records_ptr);
+        }
+        if (audio_hash_mode) {
+            MyAnalysis<MyAudioHash>(file, out, records_ptr);
+        }
+        if (trailer_mode) {
+            // all of them are usually in the tail read with the probe
+            MyAnalysis<MyID3V1>(file, out, records_ptr);
+            MyAnalysis<MyAPEv2>(file, out, records_ptr);
+            MyAnalysis<MyLyrics3>(file, out, records_ptr);
+        }
+    }
+    if (key != nullptr) {
+        scan_cache->Store(*key, filename, records);
+    }
+}
+
+// returns false if the file is not cached, and then key is filled
+// for storing the new result.
+static bool do_cached(const char *filename, std::string& out, cache_key_t **key) {
+    if (scan_cache == nullptr || !MyScanCache::MakeKey(filename, *key)) {
+        *key = nullptr;
+        return false;
+    }
+    return PrintCached(filename, **key, out);
+}
 
-    if (verbose_mode) {
-        ptr->Analyze(VerbosePrinter);
+static void do_file(const char *filename, std::string& out) {
+    if (strcmp(filename, "-") == 0) {
+        do_stream(STDIN_FILENO, filename, out);
+        return;
+    }
+    cache_key_t key_buf;
+    cache_key_t *key = &key_buf;
+    if (do_cached(filename, out, &key)) {
+        return;
+    }
+    size_t size;
+    std::vector<char> head;
+    std::vector<char> tail;
+    MyProbe::result_t probe;
+    if (!MyProbe::probe_file(filename, &size, head, tail, &probe) || size == 0) {
+        return;
+    }
+    std::shared_ptr<MyFile> file;
+    if (!MyProbe::is_target(probe, filename)) {
+        // not even opened by the backend
+    } else if (probe.has_v2 || probe.has_v2_footer) {
+        file = std::make_shared<MyFile>(filename, file_backend);
     } else {
-        printf("%s ########## %s\n", file->filename.c_str(), typeid(T).name());
-        ptr->Analyze(SimplePrinter);
-        printf("\n");
+        // the probe has read all the ID3v2 analysis needs
+        file = std::make_shared<MyFile>(filename, size, std::move(head), std::move(tail));
+    }
+    do_file(file, filename, out, key);
+}
+
+// -s and -R edit the tags before they are analyzed. A tag is put only
+// at the head of MPEG audio, never of other formats.
+static bool do_edit(const char *filename, id3v2_edit_plan_t *plan) {
+    if (strcmp(filename, "-") == 0) {
+        return false;
+    }
+    size_t size;
+    std::vector<char> head;
+    std::vector<char> tail;
+    MyProbe::result_t probe;
+    if (!MyProbe::probe_file(filename, &size, head, tail, &probe) || size == 0 ||
+        !MyProbe::is_target(probe, filename)) {
+        return false;
     }
+    if (!probe.has_v2 && probe.container != MyProbe::CONTAINER_MPEG) {
+        return false;
+    }
+    MyID3V2Edit edit(filename);
+    return edit.Prepare(edits, plan) && !plan->data.empty();
 }
 
+static void do_prefetch(const std::vector<const char*>& names, std::string& out) {
+    // one ring for each worker thread
+    thread_local MyPrefetch prefetch(2*PREFETCH_BATCH);
+    std::vector<std::string> outs(names.size());
+    std::vector<cache_key_t> key_bufs(names.size());
+    std::vector<cache_key_t*> keys(names.size());
+    std::vector<const char*> load_names;
+    std::vector<size_t> load_index;
+    for (size_t i = 0; i < names.size(); i++) {
+        keys[i] = &key_bufs[i];
+        if (strcmp(names[i], "-") == 0) {
+            do_stream(STDIN_FILENO, names[i], outs[i]);
+        } else if (!do_cached(names[i], outs[i], &keys[i])) {
+            load_names.push_back(names[i]);
+            load_index.push_back(i);
+        }
+    }
 
+    std::vector<std::shared_ptr<MyFile>> files;
+    std::vector<MyProbe::result_t> probes;
+    prefetch.Load(load_names, files, probes);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i] != nullptr) {
+            size_t index = load_index[i];
+            bool target = MyProbe::is_target(probes[i], load_names[i]);
+            do_file(target ? files[i] : nullptr, load_names[i], outs[index], keys[index]);
+        }
+    }
+    for (auto& elem : outs) {
+        out.append(elem);
+    }
+}
 
-static void do_file(const char *filename) {
-    std::shared_ptr<MyFile> file = std::make_shared<MyFile>(filename);
-    if (file->ptr != nullptr) {
-        //MyAnalysis<MyID3V1>(file);
-        MyAnalysis<MyID3V2>(file);
+// Everything which changes the analyzed records should be here.
+static uint64_t CacheOptionKey() {
+    std::string options = "ID3V2";
+    if (!printer->NeedText()) {
+        options += ",notext";
+    }
+    if (!projection_list.empty()) {
+        options += ",frames=" + projection_list;
+    }
+    if (trailer_mode) {
+        options += ",trailers";
     }
+    if (audio_mode) {
+        options += audio_full_walk ? ",audio=walk" : ",audio";
+    }
+    if (audio_hash_mode) {
+        options += ",audio-hash";
+    }
+    if (extract_mode) {
+        // stored only when analyzed, not when cached
+        options += ",extract=" + extract_dir;
+    }
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : options) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
 }
 
 
 int main(int argc, char *argv[]) {
+    std::vector<const char*> dirs;
+    std::string cache_path;
+    std::string journal_path;
+    bool stats_mode = false;
+    bool stats_json = false;
+    MyPrinter::format_t format = MyPrinter::FORMAT_SIMPLE;
     int i = 1;
     for(; i<argc; i++) {
-        if (argv[i][0] != '-') {
+        if (argv[i][0] != '-' || argv[i][1] == '\0') {
+            // "-" is stdin
             break;
         }
         switch (argv[i][1]) {
             case 'v':
-                verbose_mode = true;
+                format = MyPrinter::FORMAT_VERBOSE;
+                break;
+            case 'o':
+                // "-o text", "-o ndjson" or "-o binary"
+                if (i+1 < argc && !MyPrinter::ParseFormat(argv[++i], &format)) {
+                    fprintf(stderr, "unknown output format %s\n", argv[i]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                // walk directory by myself, and read only tag regions.
+                if (i+1 < argc) {
+                    dirs.push_back(argv[++i]);
+                }
+                prefetch_mode = true;
+                break;
+            case 'c':
+                // cache scan results in the default place
+                cache_path = MyScanCache::DefaultPath();
+                break;
+            case 'C':
+                if (i+1 < argc) {
+                    cache_path = argv[++i];
+                }
+                break;
+            case 'b':
+                // "-b mmap" or "-b pread"
+                if (i+1 < argc) {
+                    i++;
+                    if (strcmp(argv[i], "mmap") == 0) {
+                        file_backend = MyFile::BACKEND_MMAP;
+                    } else if (strcmp(argv[i], "pread") == 0) {
+                        file_backend = MyFile::BACKEND_PREAD;
+                    } else {
+                        fprintf(stderr, "unknown backend %s\n", argv[i]);
+                        return 1;
+                    }
+                }
+                break;
+            case 'f':
+                // "-f TIT2,TPE1,APIC", analyze only these frames
+                if (i+1 < argc) {
+                    projection_list = argv[++i];
+                    if (!MyID3V2::CompileProjection(projection_list.c_str(), &projection)) {
+                        return 1;
+                    }
+                }
+                break;
+            case 'x':
+                // locate and hash the payloads of APIC/GEOB
+                extract_mode = true;
+                break;
+            case 'X':
+                // "-X DIR", -x and store each payload once into DIR
+                if (i+1 < argc) {
+                    extract_dir = argv[++i];
+                }
+                extract_mode = true;
+                break;
+            case 'a':
+                // duration and bitrate of MPEG audio
+                audio_mode = true;
+                break;
+            case 'A':
+                // -a, but walk all the frames
+                audio_mode = true;
+                audio_full_walk = true;
+                break;
+            case 't':
+                // also ID3v1, APEv2 and Lyrics3v2 at the end
+                trailer_mode = true;
+                break;
+            case 's':
+                // "-s TIT2=text", repeatable, "-s TIT2=" deletes
+                if (i+1 < argc) {
+                    id3v2_edit_t edit;
+                    if (!MyID3V2Edit::ParseEdit(argv[++i], &edit)) {
+                        return 1;
+                    }
+                    edits.push_back(edit);
+                }
+                break;
+            case 'R':
+                // "-R RULES", edits of -s in a file, and "TIT2 utf8" to
+                // re-encode. Written through the journal RULES.journal.
+                if (i+1 < argc) {
+                    i++;
+                    if (!MyID3V2Edit::ParseRules(argv[i], edits)) {
+                        return 1;
+                    }
+                    if (journal_path.empty()) {
+                        journal_path = std::string(argv[i]) + ".journal";
+                    }
+                }
+                break;
+            case 'J':
+                // "-J JOURNAL", where edits are journaled
+                if (i+1 < argc) {
+                    journal_path = argv[++i];
+                }
+                break;
+            case '-':
+                // "--stats" or "--stats=json", timers and counters at exit
+                if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+                    stats_mode = true;
+                    stats_json = (argv[i][7] == '=');
+                }
+                // "--audio-hash", XXH64 of the audio without the tags
+                if (strcmp(argv[i], "--audio-hash") == 0) {
+                    audio_hash_mode = true;
+                }
+                break;
+            case 'j':
+                // accept both "-j N" and "-jN"
+                if (argv[i][2] != '\0') {
+                    job_count = atoi(&argv[i][2]);
+                } else if (i+1 < argc) {
+                    job_count = atoi(argv[++i]);
+                }
                 break;
             default:
                 break;
         }
     }
+    if (job_count == 0) {
+        job_count = MyWorkPool::DefaultWorkers();
+    }
 
-    for(; i<argc; i++) {
-        do_file(argv[i]);
+    if (stats_mode) {
+        MyStats::Enable();
+    }
+    printer = new MyPrinter(format);
+    if (!cache_path.empty()) {
+        scan_cache = new MyScanCache(cache_path, CacheOptionKey());
+    }
+
+    std::vector<std::string> walked;
+    for (auto dir : dirs) {
+        MyWalk::Walk(dir, walked);
+    }
+    std::vector<const char*> files;
+    for (auto& elem : walked) {
+        files.push_back(elem.c_str());
+    }
+    files.insert(files.end(), &argv[i], &argv[argc]);
+
+    bool edit_failed = false;
+    if (!edits.empty() || !journal_path.empty()) {
+        // Tags are prepared in parallel, and written in groups.
+        MyEditJournal journal(journal_path);
+        if (!journal.Recover()) {
+            return 1;
+        }
+        MyWorkPool edit_pool(job_count);
+        edit_pool.Start(files.size(), [&](size_t index) {
+            id3v2_edit_plan_t plan;
+            if (do_edit(files[index], &plan)) {
+                journal.Add(std::move(plan));
+            }
+        });
+        edit_pool.Wait();
+        journal.Flush();
+        if (journal.Failed() > 0) {
+            fprintf(stderr, "%zu files are not edited\n", journal.Failed());
+            edit_failed = true;
+        }
+    }
+
+    size_t batch = prefetch_mode ? PREFETCH_BATCH : 1;
+    size_t tasks = (files.size() + batch - 1) / batch;
+    MyOutput output(tasks, STDOUT_FILENO);
+    MyWorkPool pool(job_count);
+    pool.Start(tasks, [&](size_t index) {
+        std::string out;
+        size_t begin = index * batch;
+        size_t end = (begin + batch < files.size()) ? begin + batch : files.size();
+        MyStats::Count(MyStats::COUNT_FILES, end - begin);
+        if (prefetch_mode) {
+            do_prefetch(std::vector<const char*>(&files[begin], &files[end]), out);
+        } else {
+            do_file(files[begin], out);
+        }
+        output.Commit(index, std::move(out));
+    });
+    output.Flush();
+    pool.Wait();
+    if (scan_cache != nullptr) {
+        scan_cache->Save();
+        delete scan_cache;
+    }
+    if (stats_mode) {
+        MyStats::Dump(stats_json);
     }
-    return 0;
+    delete printer;
+    return edit_failed ? 1 : 0;
 }
@@ -14,6 +14,11 @@ typedef struct {
     const char* frame_name;
     const char* frame_body;
     const char* filename;
+    // Where the frame body is in the file. body_raw is false if those
+    // bytes need decoding (e.g. unsynchronization) to get the body.
+    size_t body_offset;
+    size_t body_size;
+    bool body_raw;
 } print_context_t;
 
 #endif /* _SSID3_H_ */
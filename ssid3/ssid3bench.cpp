@@ -0,0 +1,501 @@
+// Microbenchmark for the tag parsers over a synthetic corpus.
+//
+//   ssid3bench [-n FILES] [-l LOOPS] [-s SEED]
+//   ssid3bench -w DIR [-n FILES] [-s SEED]    write the corpus into DIR
+//
+// Each stage reports files/sec, frames/sec, tag bytes/sec and heap
+// allocations per file. Files are served from memory so that only the
+// parsers are measured.
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <new>
+
+#include <iconv.h>
+
+#include "ssid3.h"
+#include "myfile.h"
+#include "myid3base.h"
+#include "myid3v1.h"
+#include "myarena.h"
+#include "myid3v2.h"
+#include "myid3v2stream.h"
+#include "myid3util.h"
+
+// count every heap allocation made by the parsers
+static std::atomic<size_t> alloc_count(0);
+
+void *operator new(size_t size) {
+    alloc_count++;
+    void *p = malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+typedef enum {
+    KIND_V1,
+    KIND_V1_ENHANCED,
+    KIND_V22,
+    KIND_V23_UTF16,
+    KIND_V23_CP932,
+    KIND_V24_UTF8,
+    KIND_V23_UNSYNC,
+    KIND_V24_EXT_HEADER,
+    KIND_V23_BIG_APIC,
+    KIND_MAX,
+} bench_kind_t;
+
+typedef struct {
+    std::string name;
+    bench_kind_t kind;
+    std::vector<char> data;
+    size_t tag_size;    // bytes of ID3v2 tag, or ID3v1 tag(s)
+} bench_file_t;
+
+// xorshift64, so that the corpus is the same for the same seed.
+class BenchRand {
+public:
+    BenchRand(uint64_t seed) : m_state(seed ? seed : 1) {}
+    uint64_t Next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+    size_t Range(size_t max) {
+        return Next() % max;
+    }
+private:
+    uint64_t m_state;
+};
+
+static const char *ascii_words[] = {"Hello", "World", "Night", "Blue", "Song", "Live", "Mix", "Remaster"};
+// Shift_JIS: "漢字", "テスト", "日本語"
+static const char *cp932_words[] = {"\x8a\xbf\x8e\x9a", "\x83\x65\x83\x58\x83\x67", "\x93\xfa\x96\x7b\x8c\xea"};
+// UTF-8: "タイトル", "歌", "アルバム"
+static const char *utf8_words[] = {"\xe3\x82\xbf\xe3\x82\xa4\xe3\x83\x88\xe3\x83\xab", "\xe6\xad\x8c",
+                                   "\xe3\x82\xa2\xe3\x83\xab\xe3\x83\x90\xe3\x83\xa0"};
+
+#define ARRAY_COUNT(a) (sizeof(a)/sizeof(a[0]))
+
+static std::string MakeText(BenchRand& rand, const char **words, size_t count) {
+    std::string text;
+    size_t n = 1 + rand.Range(4);
+    for (size_t i = 0; i < n; i++) {
+        if (i != 0) {
+            text += ' ';
+        }
+        text += words[rand.Range(count)];
+    }
+    return text;
+}
+
+// UTF-16 with BOM, from ASCII and some hiragana
+static std::string MakeUTF16Text(BenchRand& rand) {
+    std::string text("\xff\xfe", 2);
+    std::string ascii = MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words));
+    for (char c : ascii) {
+        text += c;
+        text += '\0';
+    }
+    for (size_t i = rand.Range(4); i > 0; i--) {
+        text += static_cast<char>(0x42 + rand.Range(0x50));
+        text += '\x30';
+    }
+    return text;
+}
+
+static void PutBE(std::string& out, size_t value, size_t bytes, bool syncsafe) {
+    unsigned int shift = syncsafe ? 7 : 8;
+    for (size_t i = bytes; i > 0; i--) {
+        out += static_cast<char>((value >> (shift * (i-1))) & ((1u << shift) - 1));
+    }
+}
+
+static std::string MakeFrame(unsigned char version, const char *id, const std::string& body) {
+    std::string frame(id);
+    if (version == 2) {
+        PutBE(frame, body.size(), 3, false);
+    } else {
+        PutBE(frame, body.size(), 4, version == 4);
+        frame.append(2, '\0');
+    }
+    return frame + body;
+}
+
+static std::string MakeTextFrame(unsigned char version, const char *id, char enc, const std::string& text) {
+    return MakeFrame(version, id, std::string(1, enc) + text);
+}
+
+// JPEG like random data, which has many 0xff
+static std::string MakeImage(BenchRand& rand, size_t size) {
+    std::string body("\xff\xd8\xff\xe0");
+    for (size_t i = 0; i < size; i++) {
+        uint64_t r = rand.Next();
+        body += static_cast<char>((r & 0x700) == 0 ? 0xff : r);
+    }
+    return body;
+}
+
+// "0xffxx" -> "0xff00xx" if xx is 0x00 or >= 0xe0
+static std::string Unsynchronize(const std::string& in) {
+    std::string out;
+    for (size_t i = 0; i < in.size(); i++) {
+        unsigned char c = in[i];
+        out += c;
+        if (c == 0xff && (i+1 == in.size() || static_cast<unsigned char>(in[i+1]) >= 0xe0 || in[i+1] == 0)) {
+            out += '\0';
+        }
+    }
+    return out;
+}
+
+static std::string MakeV2Tag(BenchRand& rand, bench_kind_t kind) {
+    unsigned char version = 3;
+    unsigned char flag = 0;
+    std::string frames;
+    std::string ext;
+    switch (kind) {
+        case KIND_V22:
+            version = 2;
+            frames += MakeTextFrame(2, "TT2", 0, MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words)));
+            frames += MakeTextFrame(2, "TP1", 0, MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words)));
+            frames += MakeTextFrame(2, "TAL", 1, MakeUTF16Text(rand));
+            frames += MakeTextFrame(2, "TRK", 0, "3/12");
+            frames += MakeFrame(2, "PIC", std::string("\0JPG\x03\0", 6) + MakeImage(rand, 2048));
+            break;
+        case KIND_V23_UTF16:
+            frames += MakeTextFrame(3, "TIT2", 1, MakeUTF16Text(rand));
+            frames += MakeTextFrame(3, "TPE1", 1, MakeUTF16Text(rand));
+            frames += MakeTextFrame(3, "TALB", 1, MakeUTF16Text(rand));
+            frames += MakeTextFrame(3, "COMM", 1, std::string("eng\xff\xfe\0\0", 7) + MakeUTF16Text(rand));
+            break;
+        case KIND_V23_CP932:
+            frames += MakeTextFrame(3, "TIT2", 0, MakeText(rand, cp932_words, ARRAY_COUNT(cp932_words)));
+            frames += MakeTextFrame(3, "TPE1", 0, MakeText(rand, cp932_words, ARRAY_COUNT(cp932_words)));
+            frames += MakeTextFrame(3, "TALB", 0, MakeText(rand, cp932_words, ARRAY_COUNT(cp932_words)));
+            frames += MakeTextFrame(3, "TCON", 0, "(13)");
+            frames += MakeTextFrame(3, "TYER", 0, "2001");
+            break;
+        case KIND_V24_UTF8:
+        case KIND_V24_EXT_HEADER:
+            version = 4;
+            frames += MakeTextFrame(4, "TIT2", 3, MakeText(rand, utf8_words, ARRAY_COUNT(utf8_words)));
+            frames += MakeTextFrame(4, "TPE1", 3, MakeText(rand, utf8_words, ARRAY_COUNT(utf8_words)));
+            frames += MakeTextFrame(4, "TDRC", 0, "2024-01-01");
+            frames += MakeTextFrame(4, "USLT", 3, std::string("jpn\0", 4) + MakeText(rand, utf8_words, ARRAY_COUNT(utf8_words)));
+            frames += MakeFrame(4, "PRIV", std::string("owner\0", 6) + MakeImage(rand, 64));
+            if (kind == KIND_V24_EXT_HEADER) {
+                flag |= 1<<ID3V2_HEADER_FLAG_EXT_HEADER_BIT;
+                // size (including itself), one flag byte, no flags
+                PutBE(ext, 6, 4, true);
+                ext += '\x01';
+                ext += '\0';
+            }
+            break;
+        case KIND_V23_UNSYNC:
+            flag |= 1<<ID3V2_HEADER_FLAG_UNSYNC_BIT;
+            frames += MakeTextFrame(3, "TIT2", 0, MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words)));
+            frames += MakeTextFrame(3, "TPE1", 1, MakeUTF16Text(rand));
+            frames += MakeFrame(3, "APIC", std::string("\0image/jpeg\0\x03\0", 14) + MakeImage(rand, 8192));
+            frames = Unsynchronize(frames);
+            break;
+        case KIND_V23_BIG_APIC:
+            frames += MakeTextFrame(3, "TIT2", 0, MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words)));
+            frames += MakeTextFrame(3, "TPE1", 0, MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words)));
+            frames += MakeFrame(3, "APIC", std::string("\0image/jpeg\0\x03\0", 14) + MakeImage(rand, 512*1024));
+            frames += MakeTextFrame(3, "TRCK", 0, "1");
+            break;
+        default:
+            return "";
+    }
+    // some padding
+    frames.append(rand.Range(256), '\0');
+
+    std::string tag("ID3", 3);
+    tag += static_cast<char>(version);
+    tag += '\0';
+    tag += static_cast<char>(flag);
+    PutBE(tag, ext.size() + frames.size(), 4, true);
+    return tag + ext + frames;
+}
+
+static std::string MakeV1Tag(BenchRand& rand, bool enhanced) {
+    std::string tag;
+    if (enhanced) {
+        // "TAG+" title(60) artist(60) album(60) speed(1) genre(30) start(6) end(6)
+        tag = "TAG+";
+        std::string field = MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words));
+        for (int i = 0; i < 3; i++) {
+            tag += field.substr(0, 60);
+            tag.append(60 - std::min<size_t>(field.size(), 60), '\0');
+        }
+        tag += '\x01';
+        tag.append(30, '\0');
+        tag += "000:00000:00";
+    }
+    tag += "TAG";
+    for (int i = 0; i < 3; i++) {
+        std::string field = (i == 1) ? MakeText(rand, cp932_words, ARRAY_COUNT(cp932_words))
+                                     : MakeText(rand, ascii_words, ARRAY_COUNT(ascii_words));
+        tag += field.substr(0, 30);
+        tag.append(30 - std::min<size_t>(field.size(), 30), '\0');
+    }
+    tag += "1999";
+    tag += "comment";
+    tag.append(28 - 7, '\0');
+    tag += '\0';
+    tag += static_cast<char>(1 + rand.Range(20));
+    tag += static_cast<char>(rand.Range(80));
+    return tag;
+}
+
+static std::vector<bench_file_t> MakeCorpus(size_t count, uint64_t seed) {
+    BenchRand rand(seed);
+    std::vector<bench_file_t> corpus;
+    // a few MPEG frame headers as audio
+    std::string audio;
+    for (int i = 0; i < 8; i++) {
+        audio += "\xff\xfb\x90\x64";
+        audio.append(413, '\0');
+    }
+    for (size_t i = 0; i < count; i++) {
+        bench_file_t file;
+        char name[32];
+        sprintf(name, "%05zu.mp3", i);
+        file.name = name;
+        file.kind = static_cast<bench_kind_t>(i % KIND_MAX);
+        std::string data;
+        if (file.kind == KIND_V1 || file.kind == KIND_V1_ENHANCED) {
+            std::string tag = MakeV1Tag(rand, file.kind == KIND_V1_ENHANCED);
+            data = audio + tag;
+            file.tag_size = tag.size();
+        } else {
+            std::string tag = MakeV2Tag(rand, file.kind);
+            data = tag + audio;
+            file.tag_size = tag.size();
+        }
+        file.data.assign(data.begin(), data.end());
+        corpus.push_back(std::move(file));
+    }
+    return corpus;
+}
+
+static int WriteCorpus(const std::vector<bench_file_t>& corpus, const char *dir) {
+    mkdir(dir, 0755);
+    for (auto& file : corpus) {
+        std::string path = std::string(dir) + "/" + file.name;
+        int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path.c_str());
+            return 1;
+        }
+        if (write(fd, file.data.data(), file.data.size()) != static_cast<ssize_t>(file.data.size())) {
+            perror(path.c_str());
+            close(fd);
+            return 1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t files;
+    size_t frames;
+    size_t bytes;
+    size_t allocs;
+    double seconds;
+} bench_result_t;
+
+// run "func" over the files which "filter" accepts, "loops" times.
+// "func" adds frames and bytes it handled to the result.
+typedef std::function<void(std::shared_ptr<MyFile>, const bench_file_t&, bench_result_t&)> bench_func_t;
+static bench_result_t RunStage(const std::vector<bench_file_t>& corpus,
+                               const std::vector<std::shared_ptr<MyFile>>& files, size_t loops,
+                               const std::function<bool(const bench_file_t&)>& filter,
+                               const bench_func_t& func) {
+    bench_result_t result {0, 0, 0, 0, 0};
+    size_t allocs_before = alloc_count;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t loop = 0; loop < loops; loop++) {
+        for (size_t i = 0; i < corpus.size(); i++) {
+            if (!filter(corpus[i])) {
+                continue;
+            }
+            func(files[i], corpus[i], result);
+            result.files++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.allocs = alloc_count - allocs_before;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+static void PrintResult(const char *stage, const bench_result_t& result) {
+    double sec = (result.seconds > 0) ? result.seconds : 1e-9;
+    printf("%-16s %8zu %12.0f %12.0f %10.2f %10.2f\n", stage, result.files,
+           result.files / sec, result.frames / sec, result.bytes / sec / (1024*1024),
+           result.files ? static_cast<double>(result.allocs) / result.files : 0.0);
+}
+
+template<class T>
+static void SetupProjection(T*, const id3v2_projection_t*) {
+}
+static void SetupProjection(MyID3V2 *ptr, const id3v2_projection_t *projection) {
+    ptr->SetProjection(projection);
+}
+
+// same as MyAnalysis() of ssid3
+template<class T>
+static void AnalyzeFile(const std::shared_ptr<MyFile>& file, const bench_file_t& bench_file, bench_result_t& result,
+                        bool need_text, const id3v2_projection_t *projection = nullptr) {
+    if (!MyID3Base::IsTarget(*file)) {
+        return;
+    }
+    T analyzer(file);
+    analyzer.SetNeedText(need_text);
+    if (projection != nullptr) {
+        SetupProjection(&analyzer, projection);
+    }
+    analyzer.AnalyzeWith([&result](const print_context_t&) {
+        result.frames++;
+    });
+    result.bytes += bench_file.tag_size;
+}
+
+// where the text of the first frame is
+static size_t TextOffset(const bench_file_t& file) {
+    switch (file.kind) {
+        case KIND_V1:
+        case KIND_V1_ENHANCED:
+            return file.data.size() - MyID3V1::ID3V1_FRAME_SIZE + 3;
+        case KIND_V22:
+            return 10 + 6 + 1;
+        case KIND_V24_EXT_HEADER:
+            return 10 + 6 + 10 + 1;
+        default:
+            return 10 + 10 + 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t count = 1000;
+    size_t loops = 10;
+    uint64_t seed = 1;
+    const char *write_dir = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || i+1 >= argc) {
+            fprintf(stderr, "usage: %s [-n FILES] [-l LOOPS] [-s SEED] [-w DIR]\n", argv[0]);
+            return 1;
+        }
+        switch (argv[i][1]) {
+            case 'n':
+                count = atoi(argv[++i]);
+                break;
+            case 'l':
+                loops = atoi(argv[++i]);
+                break;
+            case 's':
+                seed = strtoull(argv[++i], nullptr, 0);
+                break;
+            case 'w':
+                write_dir = argv[++i];
+                break;
+            default:
+                break;
+        }
+    }
+
+    auto corpus = MakeCorpus(count, seed);
+    if (write_dir != nullptr) {
+        return WriteCorpus(corpus, write_dir);
+    }
+    std::vector<std::shared_ptr<MyFile>> files;
+    for (auto& file : corpus) {
+        files.push_back(std::make_shared<MyFile>(file.name.c_str(), file.data.size(),
+                                                 std::vector<char>(file.data), std::vector<char>()));
+    }
+
+    auto all = [](const bench_file_t&) { return true; };
+    auto is_v1 = [](const bench_file_t& file) {
+        return file.kind == KIND_V1 || file.kind == KIND_V1_ENHANCED;
+    };
+    auto is_v2 = [&is_v1](const bench_file_t& file) { return !is_v1(file); };
+    id3v2_projection_t projection;
+    MyID3V2::CompileProjection("TIT2,TPE1", &projection);
+
+    printf("%-16s %8s %12s %12s %10s %10s\n", "stage", "files", "files/s", "frames/s", "MiB/s", "allocs/f");
+    PrintResult("v2 analyze", RunStage(corpus, files, loops, is_v2,
+        [](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V2>(file, bench_file, result, true);
+        }));
+    PrintResult("v2 notext", RunStage(corpus, files, loops, is_v2,
+        [](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V2>(file, bench_file, result, false);
+        }));
+    PrintResult("v2 projection", RunStage(corpus, files, loops, is_v2,
+        [&projection](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V2>(file, bench_file, result, true, &projection);
+        }));
+    PrintResult("v2 unsync", RunStage(corpus, files, loops,
+        [](const bench_file_t& file) { return file.kind == KIND_V23_UNSYNC; },
+        [](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V2>(file, bench_file, result, true);
+        }));
+    PrintResult("v2 big APIC", RunStage(corpus, files, loops,
+        [](const bench_file_t& file) { return file.kind == KIND_V23_BIG_APIC; },
+        [](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V2>(file, bench_file, result, true);
+        }));
+    PrintResult("v2 stream 4k", RunStage(corpus, files, loops, is_v2,
+        [](std::shared_ptr<MyFile>, const bench_file_t& bench_file, bench_result_t& result) {
+            MyID3V2Stream stream(bench_file.name.c_str(), [&result](const print_context_t&) {
+                result.frames++;
+            });
+            for (size_t offset = 0; offset < bench_file.data.size(); offset += 4096) {
+                size_t size = std::min<size_t>(4096, bench_file.data.size() - offset);
+                if (!stream.Feed(&bench_file.data[offset], size)) {
+                    break;
+                }
+            }
+            stream.Finish();
+            result.bytes += bench_file.tag_size;
+        }));
+    PrintResult("v1 analyze", RunStage(corpus, files, loops, is_v1,
+        [](std::shared_ptr<MyFile> file, const bench_file_t& bench_file, bench_result_t& result) {
+            AnalyzeFile<MyID3V1>(file, bench_file, result, true);
+        }));
+    PrintResult("detect_charcode", RunStage(corpus, files, loops, all,
+        [](std::shared_ptr<MyFile>, const bench_file_t& file, bench_result_t& result) {
+            size_t offset = TextOffset(file);
+            size_t size = std::min<size_t>(30, file.data.size() - offset);
+            char charcode[16];
+            MyID3Util::detect_charcode(&file.data[offset], size, charcode);
+            result.frames++;
+            result.bytes += size;
+        }));
+    return 0;
+}